@@ -0,0 +1,185 @@
+// Buddy allocator for physically contiguous runs of pages.
+//
+// Physical memory between end and PHYSTOP is handed out in
+// blocks of 2^order pages, 0 <= order <= MAXORDER.  Pages are
+// numbered from KERNBASE, and a block of order k always starts
+// at a page number that is a multiple of 2^k, so a block is
+// aligned to its own size in physical memory, and its buddy is
+// found by flipping bit k of the page number.  Freeing a block
+// merges it with its buddy for as long as the buddy is free
+// and of the same order.
+//
+// kalloc() in kalloc.c keeps per-CPU lists of order-0 pages in
+// front of this allocator, refilled and drained in batches.
+
+#include "defs.h"
+#include "memlayout.h"
+#include "memstat.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "types.h"
+
+extern char end[];  // first address after kernel.
+                    // defined by kernel.ld.
+
+//! 空闲块通过块内第一页的前 16 字节串成双向链表
+//! 需要双向链表是因为合并时要把伙伴从它所在的链表中间摘下来
+struct block {
+    struct block* next;
+    struct block* prev;
+};
+
+struct {
+    struct spinlock lock;
+
+    //! 每个 order 一条环形链表, freelist[k] 本身是哨兵
+    struct block freelist[MAXORDER + 1];
+
+    //! 每个 order 的空闲块数
+    uint64 nfree[MAXORDER + 1];
+
+    // order of the free block that starts at each page,
+    // or -1 if no free block starts there.
+    char order[NPHYSPAGES];
+} buddy;
+
+static void push(int i, int k) {
+    struct block* b = (struct block*)PG2PA(i);
+    struct block* head = &buddy.freelist[k];
+
+    b->next = head->next;
+    b->prev = head;
+    head->next->prev = b;
+    head->next = b;
+    buddy.order[i] = k;
+    buddy.nfree[k]++;
+}
+
+static void unlink(int i, int k) {
+    struct block* b = (struct block*)PG2PA(i);
+
+    b->prev->next = b->next;
+    b->next->prev = b->prev;
+    buddy.order[i] = -1;
+    buddy.nfree[k]--;
+}
+
+void buddyinit(void) {
+    initlock(&buddy.lock, "buddy");
+    for (int k = 0; k <= MAXORDER; k++) {
+        buddy.freelist[k].next = &buddy.freelist[k];
+        buddy.freelist[k].prev = &buddy.freelist[k];
+    }
+    //! kernel 本身所占的页永远不会是空闲的, 所以也不会被合并进任何块
+    for (int i = 0; i < NPHYSPAGES; i++)
+        buddy.order[i] = -1;
+}
+
+// put the block of 2^order pages at pa back on the free
+// lists, merging it with its buddy as far as possible.
+// caller must hold buddy.lock.
+static void merge(void* pa, int order) {
+    int i, bi;
+
+    if (order < 0 || order > MAXORDER)
+        panic("buddy_free: order");
+    i = PA2PG(pa);
+    if (((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP || (i & ((1 << order) - 1)) != 0)
+        panic("buddy_free");
+
+    while (order < MAXORDER) {
+        bi = i ^ (1 << order);
+        if (bi + (1 << order) > NPHYSPAGES || buddy.order[bi] != order)
+            break;
+        //! 伙伴也空闲，将其摘下并合并成更高一阶的块
+        unlink(bi, order);
+        i &= ~(1 << order);
+        order++;
+    }
+    push(i, order);
+}
+
+// Free the block of 2^order pages at pa, which must
+// have come from buddy_alloc(order), or be memory that
+// kinit() hands over at boot.
+void buddy_free(void* pa, int order) {
+    acquire(&buddy.lock);
+    merge(pa, order);
+    release(&buddy.lock);
+}
+
+// take a block of exactly 2^order pages off the free lists,
+// splitting a larger one if needed.  returns its page number,
+// or -1.  caller must hold buddy.lock.
+static int take(int order) {
+    int i, k;
+
+    for (k = order; k <= MAXORDER; k++)
+        if (buddy.freelist[k].next != &buddy.freelist[k])
+            break;
+    if (k > MAXORDER)
+        return -1;
+
+    i = PA2PG(buddy.freelist[k].next);
+    unlink(i, k);
+
+    //! 把多余的后半部分依次放回低阶的链表中
+    while (k > order) {
+        k--;
+        push(i + (1 << k), k);
+    }
+    return i;
+}
+
+// Allocate 2^order physically contiguous pages, aligned
+// to 2^order pages.  The memory is not initialized.
+// Returns 0 if no block that large is free.
+void* buddy_alloc(int order) {
+    int i;
+
+    if (order < 0 || order > MAXORDER)
+        panic("buddy_alloc: order");
+
+    acquire(&buddy.lock);
+    i = take(order);
+    release(&buddy.lock);
+
+    if (i < 0)
+        return 0;
+    return (void*)PG2PA(i);
+}
+
+// Allocate up to n single pages into pages[], holding the
+// lock only once.  Used by kalloc() to refill a per-CPU list.
+// Returns the number of pages allocated.
+int buddy_alloc_pages(void** pages, int n) {
+    int i, got;
+
+    acquire(&buddy.lock);
+    for (got = 0; got < n; got++) {
+        if ((i = take(0)) < 0)
+            break;
+        pages[got] = (void*)PG2PA(i);
+    }
+    release(&buddy.lock);
+    return got;
+}
+
+// Free n single pages, holding the lock only once.
+void buddy_free_pages(void** pages, int n) {
+    acquire(&buddy.lock);
+    for (int j = 0; j < n; j++)
+        merge(pages[j], 0);
+    release(&buddy.lock);
+}
+
+// Fill in the buddy part of a struct memstat.
+void buddy_stat(struct memstat* st) {
+    acquire(&buddy.lock);
+    for (int k = 0; k <= MAXORDER; k++) {
+        st->nfree[k] = buddy.nfree[k];
+        st->freepages += buddy.nfree[k] << k;
+    }
+    release(&buddy.lock);
+}
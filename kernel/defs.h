@@ -8,12 +8,18 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct kmem_cache;
+struct memstat;
+struct mm;
 struct pipe;
 struct proc;
+struct shm;
 struct spinlock;
 struct sleeplock;
+struct spawnact;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void binit(void);
@@ -23,6 +29,14 @@ void bwrite(struct buf*);
 void bpin(struct buf*);
 void bunpin(struct buf*);
 
+// buddy.c
+void buddyinit(void);
+void* buddy_alloc(int);
+void buddy_free(void*, int);
+int buddy_alloc_pages(void**, int);
+void buddy_free_pages(void**, int);
+void buddy_stat(struct memstat*);
+
 // console.c
 void consoleinit(void);
 void consoleintr(int);
@@ -30,6 +44,7 @@ void consputc(int);
 
 // exec.c
 int exec(char*, char**);
+int execproc(struct proc*, char*, char**);
 
 // file.c
 struct file* filealloc(void);
@@ -60,6 +75,11 @@ void stati(struct inode*, struct stat*);
 int writei(struct inode*, int, uint64, uint, uint);
 void itrunc(struct inode*);
 
+// futex.c
+void futexinit(void);
+int futexwait(uint64, int);
+int futexwake(uint64, int);
+
 // ramdisk.c
 void ramdiskinit(void);
 void ramdiskintr(void);
@@ -69,6 +89,16 @@ void ramdiskrw(struct buf*);
 void* kalloc(void);
 void kfree(void*);
 void kinit(void);
+void* kallocmega(void);
+void kfreemega(void*);
+int kmegashared(void*);
+void kdupmega(void*);
+void kdup(void*);
+int krefcnt(void*);
+void kmemstat(struct memstat*);
+void* kzalloc(void);
+int kzeroidle(void);
+void pagezero(void*);
 
 // log.c
 void initlog(int, struct superblock*);
@@ -77,6 +107,7 @@ void begin_op(void);
 void end_op(void);
 
 // pipe.c
+void pipeinit(void);
 int pipealloc(struct file**, struct file**);
 void pipeclose(struct pipe*, int);
 int piperead(struct pipe*, uint64, int);
@@ -91,11 +122,19 @@ void printfinit(void);
 int cpuid(void);
 void exit(int);
 int fork(void);
-int growproc(int);
+int spawn(char*, char**, struct spawnact*, int);
+int clone(uint64, uint64, uint64);
+uint64 growproc(int);
 void proc_mapstacks(pagetable_t);
-pagetable_t proc_pagetable(struct proc*);
-void proc_freepagetable(pagetable_t, uint64);
+struct mm* mmalloc(struct proc*);
+void mmfree(struct mm*, struct proc*);
+void mmput(struct proc*);
+int mmlock(struct mm*);
+void mmunlock(struct mm*);
 int kill(int);
+int setpriority(int, int);
+int getpriority(int);
+void preempt(void);
 int killed(struct proc*);
 void setkilled(struct proc*);
 struct cpu* mycpu(void);
@@ -123,6 +162,20 @@ void initlock(struct spinlock*, char*);
 void release(struct spinlock*);
 void push_off(void);
 void pop_off(void);
+int cansleep(void);
+
+// shm.c
+void shminit(void);
+uint64 shmcreate(char*, uint64);
+uint64 shmattach(char*);
+void shmdup(struct shm*);
+void shmput(struct shm*);
+char* shmpage(struct shm*, uint64);
+
+// slab.c
+void kmem_cache_init(struct kmem_cache*, char*, uint);
+void* kmem_cache_alloc(struct kmem_cache*);
+void kmem_cache_free(struct kmem_cache*, void*);
 
 // sleeplock.c
 void acquiresleep(struct sleeplock*);
@@ -139,6 +192,14 @@ int strlen(const char*);
 int strncmp(const char*, const char*, uint);
 char* strncpy(char*, const char*, int);
 
+// swap.c
+void swapinit(void);
+void* ualloc(int);
+int swapin(pagetable_t, uint64, int);
+void swapdup(pte_t);
+void swapfree(pte_t);
+void swapstat(struct memstat*);
+
 // syscall.c
 void argint(int, int*);
 int argstr(int, char*, int);
@@ -153,6 +214,10 @@ void trapinit(void);
 void trapinithart(void);
 extern struct spinlock tickslock;
 void usertrapret(void);
+void ipi(int);
+void tickupdate(void);
+int timesleep(uint64);
+void timerset(void);
 
 // uart.c
 void uartinit(void);
@@ -164,6 +229,10 @@ int uartgetc(void);
 // vm.c
 void kvminit(void);
 void kvminithart(void);
+void asidinit(void);
+void asidswitch(struct proc*);
+void asidleave(void);
+void tlbintr(void);
 void kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t uvmcreate(void);
@@ -171,12 +240,21 @@ void uvmfirst(pagetable_t, uchar*, uint);
 uint64 uvmalloc(pagetable_t, uint64, uint64, int);
 uint64 uvmdealloc(pagetable_t, uint64, uint64);
 int uvmcopy(pagetable_t, pagetable_t, uint64);
+int uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
 void uvmfree(pagetable_t, uint64);
 void uvmunmap(pagetable_t, uint64, uint64, int);
 void uvmclear(pagetable_t, uint64);
+int uvmsplit(pagetable_t, uint64);
+void uvmflush(pagetable_t, uint64, uint64);
 pte_t* walk(pagetable_t, uint64, int);
+pte_t* walklevel(pagetable_t, uint64, int, int);
 uint64 walkaddr(pagetable_t, uint64);
+uint64 walkwaddr(pagetable_t, uint64);
+void upin(uint64);
+void uunpin(void);
 int copyout(pagetable_t, uint64, char*, uint64);
+int cowfault(pagetable_t, uint64);
+int vmfault(pagetable_t, uint64, int);
 int copyin(pagetable_t, char*, uint64, uint64);
 int copyinstr(pagetable_t, char*, uint64, uint64);
 
@@ -186,6 +264,19 @@ void plicinithart(void);
 int plic_claim(void);
 void plic_complete(int);
 
+// vma.c
+struct vma* vmalookup(struct mm*, uint64);
+int vmaload(struct mm*, struct vma*, uint64, int);
+void vmaprefault(uint64, int, int);
+int vmashare(struct mm*);
+int vmacopy(struct mm*, struct mm*);
+void vmafree(struct vma*);
+int vmaunmap(struct mm*, uint64, uint64);
+uint64 vmalimit(struct mm*);
+int vmaoverlap(struct mm*, uint64, uint64);
+uint64 vmammap(uint64, int, int, struct file*, uint);
+uint64 vmashm(struct shm*, uint64);
+
 // virtio_disk.c
 void virtio_disk_init(void);
 void virtio_disk_rw(struct buf*, int);
@@ -1,5 +1,6 @@
 #include "defs.h"
 #include "elf.h"
+#include "fcntl.h"
 #include "memlayout.h"
 #include "param.h"
 #include "proc.h"
@@ -7,8 +8,6 @@
 #include "spinlock.h"
 #include "types.h"
 
-static int loadseg(pde_t*, uint64, struct inode*, uint, uint);
-
 int flags2perm(int flags) {
     int perm = 0;
     if (flags & 0x1)
@@ -21,6 +20,16 @@ int flags2perm(int flags) {
 //! 加载器
 //! 思考加载器是如何做到返回用户态的
 int exec(char* path, char** argv) {
+    return execproc(myproc(), path, argv);
+}
+
+// Replace the user memory of p with the program at path,
+// and set up p's trapframe to start it with arguments argv.
+// p is the current process (exec), or a new process that
+// is not running yet (spawn).  p gets an address space of
+// its own; the other threads of its old one keep using it.
+// Returns argc, or -1 if p's memory is left unchanged.
+int execproc(struct proc* p, char* path, char** argv) {
     char *s, *last;
 
     int i, off;
@@ -33,9 +42,13 @@ int exec(char* path, char** argv) {
 
     struct proghdr ph;
 
-    pagetable_t pagetable = 0, oldpagetable;
+    struct vma vmas[NVMA], *v;
+
+    struct mm* mm = 0;
 
-    struct proc* p = myproc();
+    pagetable_t pagetable;
+
+    memset(vmas, 0, sizeof(vmas));
 
     begin_op();
 
@@ -52,10 +65,13 @@ int exec(char* path, char** argv) {
     if (elf.magic != ELF_MAGIC)
         goto bad;
 
-    if ((pagetable = proc_pagetable(p)) == 0)
+    if ((mm = mmalloc(p)) == 0)
         goto bad;
+    pagetable = mm->pagetable;
 
-    // Load program into memory.
+    // Record where each segment's pages come from in the file;
+    // vmfault() reads them in when the program touches them.
+    v = vmas;
     for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)) {
         if (readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
             goto bad;
@@ -67,21 +83,26 @@ int exec(char* path, char** argv) {
             goto bad;
         if (ph.vaddr % PGSIZE != 0)
             goto bad;
-        uint64 sz1;
-        //! 直接申请整个用到的大小, 因为它堆和栈是反过来的...
-        if ((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
+        if (ph.vaddr + ph.memsz > MMAPTOP)
             goto bad;
-        sz = sz1;
-        if (loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+        if (v == &vmas[NVMA])
             goto bad;
+        //! 不读盘, 只记下这一段在文件中的位置
+        v->start = ph.vaddr;
+        v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+        v->perm = PTE_R | PTE_U | flags2perm(ph.flags);
+        v->flags = MAP_PRIVATE;
+        v->off = ph.off;
+        v->filesz = ph.filesz;
+        v->ip = idup(ip);
+        if (v->end > sz)
+            sz = v->end;
+        v++;
     }
     iunlockput(ip);
     end_op();
     ip = 0;
 
-    p = myproc();
-    uint64 oldsz = p->sz;
-
     // Allocate two pages at the next page boundary.
     // Make the first inaccessible as a stack guard.
     // Use the second as the user stack.
@@ -145,50 +166,42 @@ int exec(char* path, char** argv) {
     safestrcpy(p->name, last, sizeof(p->name));
     //!  ignore --------------------------------------------------------
 
+    // Drop the old address space; if p was its last thread,
+    // that writes back MAP_SHARED regions and frees it.
+    if (p->mm)
+        mmput(p);
+
     // Commit to the user image.
-    // ! 销毁原来的页表并用加载时新建的页表替换
+    // ! 用加载时新建的地址空间替换原来的
     // ! 设置 trapframe 的 epc 和 sp
     // ! 从 exec 返回系统调用后，继续执行中断处理程序时，会把这些上下文恢复
     // ! 从而实现回到用户态时从入口函数开始执行
-    oldpagetable = p->pagetable;
-    p->pagetable = pagetable;
-    p->sz = sz;
+    memmove(mm->vmas, vmas, sizeof(vmas));
+    mm->sz = sz;
+    p->mm = mm;
     p->trapframe->epc = elf.entry;  // initial program counter = main
     p->trapframe->sp = sp;          // initial stack pointer
-    proc_freepagetable(oldpagetable, oldsz);
+    //! 新的地址空间要用新的 ASID, TLB 中旧 ASID 的项都作废了
+    //! 还没运行过的新进程, 调度器第一次运行它时才分配
+    if (p == myproc())
+        asidswitch(p);
 
     //! 这里的 return
     return argc;  // this ends up in a0, the first argument to main(argc, argv)
 
 bad:
-    if (pagetable)
-        proc_freepagetable(pagetable, sz);
+    if (mm) {
+        mm->sz = sz;
+        mmfree(mm, p);
+    }
     if (ip) {
+        vmafree(vmas);
         iunlockput(ip);
         end_op();
+    } else {
+        begin_op();
+        vmafree(vmas);
+        end_op();
     }
     return -1;
 }
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int loadseg(pagetable_t pagetable, uint64 va, struct inode* ip, uint offset, uint sz) {
-    uint i, n;
-    uint64 pa;
-
-    for (i = 0; i < sz; i += PGSIZE) {
-        pa = walkaddr(pagetable, va + i);
-        if (pa == 0)
-            panic("loadseg: address should exist");
-        if (sz - i < PGSIZE)
-            n = sz - i;
-        else
-            n = PGSIZE;
-        if (readi(ip, 0, (uint64)pa, offset + i, n) != n)
-            return -1;
-    }
-
-    return 0;
-}
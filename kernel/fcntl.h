@@ -3,3 +3,27 @@
 #define O_RDWR 0x002
 #define O_CREATE 0x200
 #define O_TRUNC 0x400
+
+// mmap() protection and flags.
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+
+// spawn() file actions, applied in order to the child's copy
+// of the caller's open files.  A list of them ends with op 0.
+#define SPAWN_DUP2 1   // make newfd refer to fd's file
+#define SPAWN_CLOSE 2  // close fd
+
+struct spawnact {
+    int op;
+    int fd;
+    int newfd;
+};
+
+// futex() operations.
+#define FUTEX_WAIT 1  // sleep if *addr == val
+#define FUTEX_WAKE 2  // wake up to val threads sleeping on addr
@@ -9,37 +9,35 @@
 #include "proc.h"
 #include "riscv.h"
 #include "sleeplock.h"
+#include "slab.h"
 #include "spinlock.h"
 #include "stat.h"
 #include "types.h"
 
 struct devsw devsw[NDEV];
 
+//! 打开文件不再是一张固定大小的表, 而是从 slab 中按需分配
+//! ftable.lock 只用来保护各个 file 的引用计数
 struct {
     struct spinlock lock;
-    struct file file[NFILE];
+    struct kmem_cache cache;
 } ftable;
 
 void fileinit(void) {
     initlock(&ftable.lock, "ftable");
+    kmem_cache_init(&ftable.cache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
-//! 与进程表采用同样的方式进行分配...
-//! 简单遍历
+// Returns 0 if out of memory.
 struct file* filealloc(void) {
     struct file* f;
 
-    acquire(&ftable.lock);
-    for (f = ftable.file; f < ftable.file + NFILE; f++) {
-        if (f->ref == 0) {
-            f->ref = 1;
-            release(&ftable.lock);
-            return f;
-        }
-    }
-    release(&ftable.lock);
-    return 0;
+    if ((f = kmem_cache_alloc(&ftable.cache)) == 0)
+        return 0;
+    memset(f, 0, sizeof(*f));
+    f->ref = 1;
+    return f;
 }
 
 // Increment ref count for file f.
@@ -68,6 +66,8 @@ void fileclose(struct file* f) {
     f->type = FD_NONE;
     release(&ftable.lock);
 
+    kmem_cache_free(&ftable.cache, f);
+
     if (ff.type == FD_PIPE) {
         pipeclose(ff.pipe, ff.writable);
     } else if (ff.type == FD_INODE || ff.type == FD_DEVICE) {
@@ -87,7 +87,7 @@ int filestat(struct file* f, uint64 addr) {
         ilock(f->ip);
         stati(f->ip, &st);
         iunlock(f->ip);
-        if (copyout(p->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+        if (copyout(p->mm->pagetable, addr, (char*)&st, sizeof(st)) < 0)
             return -1;
         return 0;
     }
@@ -17,6 +17,7 @@
 #include "proc.h"
 #include "riscv.h"
 #include "sleeplock.h"
+#include "slab.h"
 #include "spinlock.h"
 #include "stat.h"
 #include "types.h"
@@ -173,22 +174,29 @@ static void bfree(int dev, uint b) {
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
 //
+// In-memory inodes come from a slab cache, so there is no fixed
+// limit on how many can be active.  The table is a hash on
+// (dev, inum) of the inodes with ip->ref > 0; an inode is freed
+// as soon as its last reference goes away, and is read from the
+// buffer cache again the next time it is needed.
+//
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+
 struct {
     struct spinlock lock;
-    struct inode inode[NINODE];
+    struct inode* hash[NIHASH];
+    struct kmem_cache cache;
 } itable;
 
-void iinit() {
-    int i = 0;
+#define IHASH(dev, inum) (((dev)*31 + (inum)) % NIHASH)
 
+void iinit() {
     initlock(&itable.lock, "itable");
-    for (i = 0; i < NINODE; i++) {
-        initsleeplock(&itable.inode[i].lock, "inode");
-    }
+    kmem_cache_init(&itable.cache, "inode", sizeof(struct inode));
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -196,24 +204,30 @@ static struct inode* iget(uint dev, uint inum);
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
-// or NULL if there is no free inode.
+// or NULL if there is no free inode, or no memory for one.
 struct inode* ialloc(uint dev, short type) {
     int inum;
     struct buf* bp;
     struct dinode* dip;
+    struct inode* ip;
 
     //! 同样读取 bitmap 中关于 indoe 的块，遍历读取
     for (inum = 1; inum < sb.ninodes; inum++) {
         bp = bread(dev, IBLOCK(inum, sb));
         dip = (struct dinode*)bp->data + inum % IPB;
         if (dip->type == 0) {  // a free inode
+            //! 先拿到内存中的 inode, 失败时磁盘上还没有标记为已分配
+            if ((ip = iget(dev, inum)) == 0) {
+                brelse(bp);
+                return 0;
+            }
             memset(dip, 0, sizeof(*dip));
             dip->type = type;
             //! 将 inode 的信息同步到磁盘
             log_write(bp);  // mark it allocated on the disk
             brelse(bp);
             //! 返回新建的 inode
-            return iget(dev, inum);
+            return ip;
         }
         brelse(bp);
     }
@@ -246,34 +260,35 @@ void iupdate(struct inode* ip) {
 // ! return the in-memory copy.
 // Does not lock the inode and does not read it from disk.
 static struct inode* iget(uint dev, uint inum) {
-    struct inode *ip, *empty;
+    struct inode* ip;
+    struct inode** bucket = &itable.hash[IHASH(dev, inum)];
 
     acquire(&itable.lock);
 
     // Is the inode already in the table?
-    empty = 0;
-
-    //! 在 inode table 中寻找，如果找到则返回，否则随便扯一个填入信息
-    for (ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++) {
-        if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
+    //! 只需要在对应的 hash 链上寻找，找不到就从 slab 中新分配一个
+    for (ip = *bucket; ip; ip = ip->next) {
+        if (ip->dev == dev && ip->inum == inum) {
             ip->ref++;
             release(&itable.lock);
             return ip;
         }
-        if (empty == 0 && ip->ref == 0)  // Remember empty slot.
-            empty = ip;
     }
 
-    // Recycle an inode entry.
-    //!? 实验一下打开超过 50 个文件是否会溢出
-    if (empty == 0)
-        panic("iget: no inodes");
+    // Allocate a new inode entry.
+    if ((ip = kmem_cache_alloc(&itable.cache)) == 0) {
+        release(&itable.lock);
+        printf("iget: no inodes\n");
+        return 0;
+    }
 
-    ip = empty;
+    initsleeplock(&ip->lock, "inode");
     ip->dev = dev;
     ip->inum = inum;
     ip->ref = 1;
     ip->valid = 0;
+    ip->next = *bucket;
+    *bucket = ip;
     release(&itable.lock);
 
     return ip;
@@ -326,8 +341,8 @@ void iunlock(struct inode* ip) {
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry is
+// freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -355,6 +370,15 @@ void iput(struct inode* ip) {
     }
 
     ip->ref--;
+    if (ip->ref == 0) {
+        struct inode** pp = &itable.hash[IHASH(ip->dev, ip->inum)];
+        while (*pp != ip)
+            pp = &(*pp)->next;
+        *pp = ip->next;
+        release(&itable.lock);
+        kmem_cache_free(&itable.cache, ip);
+        return;
+    }
     release(&itable.lock);
 }
 
@@ -533,6 +557,7 @@ int namecmp(const char* s, const char* t) {
 
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// Returns 0 if not found, or if iget() has no memory.
 //! 简单的遍历目录，找到则返回 inode
 struct inode* dirlookup(struct inode* dp, char* name, uint* poff) {
     uint off, inum;
@@ -562,23 +587,24 @@ struct inode* dirlookup(struct inode* dp, char* name, uint* poff) {
 // Returns 0 on success, -1 on failure (e.g. out of disk blocks).
 //! 按 de 为单位遍历，找到空的 de，填入信息
 int dirlink(struct inode* dp, char* name, uint inum) {
-    int off;
+    int off, empty = -1;
     struct dirent de;
-    struct inode* ip;
 
-    // Check that name is not present.
-    if ((ip = dirlookup(dp, name, 0)) != 0) {
-        iput(ip);
-        return -1;
-    }
-
-    // Look for an empty dirent.
+    // Check that name is not present, and look for an empty
+    // dirent.
+    //! 不用 dirlookup(): iget() 没有内存时它也返回 0, 会被当成不存在
     for (off = 0; off < dp->size; off += sizeof(de)) {
         if (readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
             panic("dirlink read");
-        if (de.inum == 0)
-            break;
+        if (de.inum == 0) {
+            if (empty < 0)
+                empty = off;
+        } else if (namecmp(name, de.name) == 0) {
+            return -1;
+        }
     }
+    if (empty >= 0)
+        off = empty;
 
     strncpy(de.name, name, DIRSIZ);
     de.inum = inum;
@@ -637,6 +663,8 @@ static struct inode* namex(char* path, int nameiparent, char* name) {
         ip = iget(ROOTDEV, ROOTINO);
     else
         ip = idup(myproc()->cwd);
+    if (ip == 0)
+        return 0;
 
     while ((path = skipelem(path, name)) != 0) {
         ilock(ip);
@@ -0,0 +1,155 @@
+// Fast user-space locking (futexes).
+//
+// Threads that share an address space (see clone()) take and
+// release locks with atomic instructions on a word of user
+// memory, and only enter the kernel when they have to wait:
+// futexwait() sleeps as long as the word still holds the
+// value the thread saw, and futexwake() wakes threads that
+// wait on the word after it changed.
+//
+// Waiters are kept in a small hash table.  A word in private
+// memory is known by its address space and virtual address,
+// which stay the same when copy-on-write or swapping (swap.c)
+// moves the page.  A word in memory that processes share (a
+// MAP_SHARED region or a shm.c object) is known by its
+// physical address instead, which is the same for all of
+// them; those pages are never copied or swapped out.  A
+// waiter's record lives on its kernel stack.  The word is
+// checked under the bucket's lock, which futexwake() also
+// takes, so a wakeup that comes after the word changed can
+// not be missed.
+
+#include "defs.h"
+#include "fcntl.h"
+#include "param.h"
+#include "proc.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "types.h"
+
+// number of hash buckets.
+#define NFUTEXHASH 31
+
+// what a futex is known by.
+struct key {
+    struct mm* mm;  // address space, or 0 if shared
+    uint64 addr;    // virtual address, or physical if shared
+};
+
+struct waiter {
+    struct key key;       // the word waited on
+    int woken;            // set by futexwake()
+    struct waiter* next;  // next waiter in the bucket
+};
+
+struct bucket {
+    struct spinlock lock;
+    struct waiter* head;
+};
+
+struct bucket futextab[NFUTEXHASH];
+
+void futexinit(void) {
+    for (int i = 0; i < NFUTEXHASH; i++)
+        initlock(&futextab[i].lock, "futex");
+}
+
+// Set *k to the key of the int at user address va of the
+// current process, and return its physical address, faulting
+// its page in (and breaking copy-on-write sharing, since the
+// word is about to be written).
+// Returns 0 if va is not aligned or not writable.
+static uint64 futexaddr(uint64 va, struct key* k) {
+    struct mm* mm = myproc()->mm;
+    struct vma* v;
+    uint64 pa;
+
+    if (va % sizeof(int) != 0)
+        return 0;
+    vmaprefault(va, sizeof(int), 1);
+    if (mmlock(mm) < 0)
+        return 0;
+    if ((pa = walkwaddr(mm->pagetable, va)) == 0) {
+        mmunlock(mm);
+        return 0;
+    }
+    pa += va & (PGSIZE - 1);
+    //! 私有内存的页会被 COW 复制或换出, 物理地址会变; 共享的页不会
+    v = vmalookup(mm, va);
+    if (v != 0 && (v->shm || (v->flags & MAP_SHARED))) {
+        k->mm = 0;
+        k->addr = pa;
+    } else {
+        k->mm = mm;
+        k->addr = va;
+    }
+    mmunlock(mm);
+    return pa;
+}
+
+static struct bucket* hash(struct key* k) {
+    return &futextab[(((uint64)k->mm >> 4) ^ (k->addr >> 2)) % NFUTEXHASH];
+}
+
+// Sleep until futexwake() on va, if the int at va is val.
+// Returns 0 when woken, -1 at once if the int is not val,
+// or if va is bad or the process is killed.
+int futexwait(uint64 va, int val) {
+    struct proc* p = myproc();
+    struct waiter w, **wp;
+    struct bucket* b;
+    uint64 pa;
+
+    if (futexaddr(va, &w.key) == 0)
+        return -1;
+    w.woken = 0;
+    b = hash(&w.key);
+
+    acquire(&b->lock);
+    //! futexaddr() 之后别的线程可能 fork 了, 又往 COW 出来的新页里写了值并 futexwake()
+    //! 所以在桶锁下重新查页表, 读现在映射着的那一页
+    pa = walkaddr(p->mm->pagetable, va);
+    if (pa == 0 || *(volatile int*)(pa + (va & (PGSIZE - 1))) != val) {
+        release(&b->lock);
+        return -1;
+    }
+    w.next = b->head;
+    b->head = &w;
+    while (!w.woken && !killed(p))
+        sleep(&w, &b->lock);
+    //! 被 kill 时自己从链表里摘下来
+    if (!w.woken) {
+        for (wp = &b->head; *wp != &w; wp = &(*wp)->next)
+            ;
+        *wp = w.next;
+    }
+    release(&b->lock);
+    return w.woken ? 0 : -1;
+}
+
+// Wake up to n threads waiting on va.
+// Returns the number woken, or -1 if va is bad.
+int futexwake(uint64 va, int n) {
+    struct waiter *w, **wp;
+    struct bucket* b;
+    struct key k;
+    int woken = 0;
+
+    if (futexaddr(va, &k) == 0)
+        return -1;
+    b = hash(&k);
+
+    acquire(&b->lock);
+    for (wp = &b->head; (w = *wp) != 0 && woken < n;) {
+        if (w->key.mm != k.mm || w->key.addr != k.addr) {
+            wp = &w->next;
+            continue;
+        }
+        *wp = w->next;
+        w->woken = 1;
+        wakeup(w);
+        woken++;
+    }
+    release(&b->lock);
+    return woken;
+}
@@ -1,9 +1,22 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// This is the order-0 fast path in front of the buddy
+// allocator in buddy.c; see buddy_alloc() for larger,
+// physically contiguous allocations.
+//
+// Most pages end up being zeroed (page tables, user memory),
+// so each CPU also keeps a few pages that were zeroed while it
+// had nothing else to do; kzalloc() hands those out first.
+//
+// Build with KALLOC_JUNK=1 to fill freed and newly allocated
+// pages with junk, to catch dangling references and reads of
+// memory that was never initialized.
 
 #include "defs.h"
 #include "memlayout.h"
+#include "memstat.h"
 #include "param.h"
 #include "riscv.h"
 #include "spinlock.h"
@@ -22,58 +35,254 @@ struct run {
     struct run* next;
 };
 
-struct {
-    //! 用于多核并发的锁
+// number of pages moved at once between a CPU's free list
+// and the buddy allocator, or another CPU's free list.
+#define KBATCH 32
+
+// a CPU's free list is drained back to the buddy allocator
+// once it holds more than this many pages.
+#define KCACHEMAX (2 * KBATCH)
+
+// buddy order of the 2 MB blocks behind megapages.
+#define MEGAORDER 9
+
+// pages kallocmega() leaves to 4 KB allocations, so that
+// swap.c can still split megapages when memory runs out.
+#define MEGARESERVE 512
+
+// most pre-zeroed pages a CPU keeps for kzalloc().
+#define KZEROMAX 64
+
+// set by start() if the harts can zero a cache block at a
+// time with cbo.zero (the Zicboz extension).
+extern int zicboz;
+
+//! 每个 CPU 都有自己的空闲链表，kalloc / kfree 只需要拿本 CPU 的锁
+//! 本 CPU 的链表为空时，先从 buddy 批量补充，buddy 也空了才去其他 CPU 的链表中批量"偷"页
+//! 因此锁基本不会发生竞争
+struct kmem {
+    //! 保护 freelist, 其他 CPU 偷页时也需要获取
     struct spinlock lock;
 
     //! 显式空闲链表
     struct run* freelist;
 
-} kmem;
+    //! 链表中的页数
+    int nfree;
+
+    //! 已经清零的页, 由空闲时的 kzeroidle() 补充, 给 kzalloc() 用
+    //! 这些页已经被 kalloc 过 (引用计数为 1), 不算在 nfree 中
+    struct run* zerolist;
+    int nzero;
+};
+
+struct kmem kmems[NCPU];
+
+//! 每个物理页的引用计数，用于 COW fork 后父子进程共享同一页
+//! kalloc 时置 1, kfree 只是减 1, 减到 0 时才真正释放
+//! 使用原子操作，不需要额外的锁
+int pageref[NPHYSPAGES];
 
 void kinit() {
-    initlock(&kmem.lock, "kmem");
+    for (int i = 0; i < NCPU; i++)
+        initlock(&kmems[i].lock, "kmem");
+    buddyinit();
 
-    //! 将一整段空间添加入空闲链表中 ( 从内核结束的位置开始一直到物理内存结束 )
+    //! 将一整段空间交给 buddy 管理 ( 从内核结束的位置开始一直到物理内存结束 )
+    //! 各个 CPU 的链表一开始都是空的，第一次分配时从 buddy 批量补充
     freerange(end, (void*)PHYSTOP);
 }
 
 void freerange(void* pa_start, void* pa_end) {
     char* p;
+    int order;
 
     //! 做了一个向上取整的对齐操作, 将地址对齐到 4096 的倍数
     p = (char*)PGROUNDUP((uint64)pa_start);
 
-    //! 对于每块地址，进行单独的释放
-    for (; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-        kfree(p);
+    //! 每次释放一个尽可能大的、按自身大小对齐的块
+    while (p + PGSIZE <= (char*)pa_end) {
+        order = 0;
+        while (order < MAXORDER && ((uint64)p - KERNBASE) % ((uint64)PGSIZE << (order + 1)) == 0 &&
+               p + ((uint64)PGSIZE << (order + 1)) <= (char*)pa_end)
+            order++;
+        buddy_free(p, order);
+        p += (uint64)PGSIZE << order;
+    }
+}
+
+// Move up to KBATCH free pages from some other CPU's
+// free list to CPU id's, and return one of them.
+// Returns 0 if every CPU is out of memory.
+// Caller must have interrupts off and must not hold
+// any kmem lock; at most one kmem lock is held at a time.
+static struct run* ksteal(int id) {
+    struct run *r, *first, *last;
+    int n;
+
+    for (int i = 1; i < NCPU; i++) {
+        struct kmem* victim = &kmems[(id + i) % NCPU];
+
+        acquire(&victim->lock);
+        first = victim->freelist;
+        if (first == 0) {
+            release(&victim->lock);
+            continue;
+        }
+        //! 从链表头摘下至多 KBATCH 个页
+        last = first;
+        for (n = 1; n < KBATCH && last->next; n++)
+            last = last->next;
+        victim->freelist = last->next;
+        victim->nfree -= n;
+        release(&victim->lock);
+
+        //! 留下一页返回，剩下的挂到本 CPU 的链表上
+        r = first;
+        if (n > 1) {
+            struct kmem* km = &kmems[id];
+            acquire(&km->lock);
+            last->next = km->freelist;
+            km->freelist = first->next;
+            km->nfree += n - 1;
+            release(&km->lock);
+        }
+        return r;
+    }
+    return 0;
+}
+
+// Refill CPU id's free list with up to KBATCH pages from
+// the buddy allocator, and return one of them.
+// Returns 0 if the buddy allocator has no pages left.
+// Caller must have interrupts off.
+static struct run* krefill(int id) {
+    void* pages[KBATCH];
+    struct kmem* km = &kmems[id];
+    int n;
+
+    if ((n = buddy_alloc_pages(pages, KBATCH)) == 0)
+        return 0;
+
+    acquire(&km->lock);
+    for (int i = 1; i < n; i++) {
+        struct run* r = (struct run*)pages[i];
+        r->next = km->freelist;
+        km->freelist = r;
+    }
+    km->nfree += n - 1;
+    release(&km->lock);
+
+    return (struct run*)pages[0];
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc().  If the page is shared (see kdup()),
+// only drop this reference.
 void kfree(void* pa) {
     struct run* r;
+    struct kmem* km;
+    void* pages[KBATCH];
+    int n = 0, ref;
 
     //! 空间不对齐，panic
     if (((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
         panic("kfree");
 
+    //! 还有别人在用这一页
+    if ((ref = __sync_sub_and_fetch(&pageref[PA2PG(pa)], 1)) > 0)
+        return;
+    if (ref < 0)
+        panic("kfree: ref");
+
+#ifdef KALLOC_JUNK
     // Fill with junk to catch dangling refs.
     memset(pa, 1, PGSIZE);
+#endif
 
     //! 让 run 的 next 指向当前的 physical address
     //! 这里其实可以写的不用那么...抽象的...
     r = (struct run*)pa;
 
-    acquire(&kmem.lock);
+    // cpuid() is only stable with interrupts off.
+    push_off();
+    km = &kmems[cpuid()];
+
+    acquire(&km->lock);
 
     //! 进行了一个头插的链表操作
-    r->next = kmem.freelist;
-    kmem.freelist = r;
+    r->next = km->freelist;
+    km->freelist = r;
+    km->nfree++;
+
+    //! 本 CPU 缓存的页太多了，还一批给 buddy，让它有机会合并出大块
+    if (km->nfree > KCACHEMAX) {
+        for (n = 0; n < KBATCH; n++) {
+            pages[n] = km->freelist;
+            km->freelist = km->freelist->next;
+        }
+        km->nfree -= n;
+    }
+
+    release(&km->lock);
+
+    if (n > 0)
+        buddy_free_pages(pages, n);
+
+    pop_off();
+}
+
+// Take a page from km's pre-zeroed list, or return 0.
+static struct run* kzeropop(struct kmem* km) {
+    struct run* r;
+
+    acquire(&km->lock);
+    if ((r = km->zerolist) != 0) {
+        km->zerolist = r->next;
+        km->nzero--;
+    }
+    release(&km->lock);
+    //! 链表指针写在页的第一个字里, 拿出来后要重新清零
+    if (r)
+        r->next = 0;
+    return r;
+}
+
+// Take a page from this CPU's free list, refilling the list
+// if it is empty, and give it a reference count of 1.
+// Returns 0 if there are no free pages.
+static struct run* kpop(void) {
+    struct run* r;
+    struct kmem* km;
+    int id;
+
+    push_off();
+    id = cpuid();
+    km = &kmems[id];
+
+    acquire(&km->lock);
+
+    //! 很简单的 pop_front 操作
+    r = km->freelist;
+    if (r) {
+        km->freelist = r->next;
+        km->nfree--;
+    }
 
-    release(&kmem.lock);
+    release(&km->lock);
+
+    //! 本 CPU 没有空闲页了，先找 buddy 补充，再去别的 CPU 那里偷
+    if (r == 0)
+        r = krefill(id);
+    if (r == 0)
+        r = ksteal(id);
+
+    pop_off();
+
+    if (r)
+        pageref[PA2PG(r)] = 1;
+    return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -82,16 +291,158 @@ void kfree(void* pa) {
 void* kalloc(void) {
     struct run* r;
 
-    acquire(&kmem.lock);
+    //! 实在没有了, 清零池里的页也可以用 (引用计数已经是 1)
+    if ((r = kpop()) == 0) {
+        push_off();
+        for (int i = 0; i < NCPU && r == 0; i++)
+            r = kzeropop(&kmems[(cpuid() + i) % NCPU]);
+        pop_off();
+    }
 
-    //! 很简单的 pop_front 操作
-    r = kmem.freelist;
+#ifdef KALLOC_JUNK
     if (r)
-        kmem.freelist = r->next;
+        memset((char*)r, 5, PGSIZE);  // fill with junk
+#endif
+    return (void*)r;
+}
 
-    release(&kmem.lock);
+// Set the page at pa to zeros, a cache block at a time if
+// the hart has cbo.zero, else a word at a time.
+void pagezero(void* pa) {
+    char* a;
+
+    if (zicboz) {
+        for (a = (char*)pa; a < (char*)pa + PGSIZE; a += CBOZSIZE)
+            cbo_zero(a);
+    } else {
+        for (uint64* w = (uint64*)pa; w < (uint64*)((char*)pa + PGSIZE); w++)
+            *w = 0;
+    }
+}
 
+// Allocate one page of physical memory, set to zeros.
+// Returns 0 if the memory cannot be allocated.
+void* kzalloc(void) {
+    struct run* r;
+    void* pa;
+
+    push_off();
+    r = kzeropop(&kmems[cpuid()]);
+    pop_off();
     if (r)
-        memset((char*)r, 5, PGSIZE);  // fill with junk
-    return (void*)r;
+        return (void*)r;
+
+    if ((pa = kalloc()) != 0)
+        pagezero(pa);
+    return pa;
+}
+
+// Called by the scheduler when this CPU has nothing to run:
+// zero a free page for a later kzalloc().
+// Returns 1 if it zeroed a page, 0 if the pool is full
+// or there are no free pages.
+int kzeroidle(void) {
+    struct kmem* km;
+    struct run* r;
+    int full;
+
+    push_off();
+    full = __atomic_load_n(&kmems[cpuid()].nzero, __ATOMIC_RELAXED) >= KZEROMAX;
+    pop_off();
+    //! 只拿真正空闲的页; 内存不够时 kalloc() 也会从池子里拿页
+    if (full || (r = kpop()) == 0)
+        return 0;
+
+    //! 清零时开着中断, 也不持有锁
+    pagezero(r);
+
+    push_off();
+    km = &kmems[cpuid()];
+    acquire(&km->lock);
+    r->next = km->zerolist;
+    km->zerolist = r;
+    km->nzero++;
+    release(&km->lock);
+    pop_off();
+    return 1;
+}
+
+// Allocate a 2 MB block, aligned to 2 MB, to back a megapage.
+// Each of its pages has a reference count of 1, so after the
+// megapage is split they can be kfree()d one by one.
+// The memory is not initialized.  Returns 0 if no block is free,
+// or if memory is getting short.
+void* kallocmega(void) {
+    struct memstat st;
+    char* pa;
+
+    //! 拆分超级页需要一个页表页, 内存快用完时就不再给超级页了
+    memset(&st, 0, sizeof(st));
+    buddy_stat(&st);
+    if (st.freepages < MEGAPGSIZE / PGSIZE + MEGARESERVE)
+        return 0;
+    if ((pa = buddy_alloc(MEGAORDER)) == 0)
+        return 0;
+    for (int i = 0; i < MEGAPGSIZE / PGSIZE; i++)
+        pageref[PA2PG(pa) + i] = 1;
+    return pa;
+}
+
+// Whether a page of the block from kallocmega() at pa has a
+// reference besides the caller's.
+int kmegashared(void* pa) {
+    for (int i = 0; i < MEGAPGSIZE / PGSIZE; i++)
+        if (krefcnt((char*)pa + i * PGSIZE) != 1)
+            return 1;
+    return 0;
+}
+
+// Drop a megapage mapping's reference to each page of the
+// block from kallocmega() at pa.  The block goes back whole if
+// nobody else refers to it; otherwise the pages are freed one
+// by one as their last references go.
+void kfreemega(void* pa) {
+    if (kmegashared(pa)) {
+        //! fork 之后共享的超级页, 别的页表 (可能已经拆开了) 还在用其中的页
+        for (int i = 0; i < MEGAPGSIZE / PGSIZE; i++)
+            kfree((char*)pa + i * PGSIZE);
+        return;
+    }
+    for (int i = 0; i < MEGAPGSIZE / PGSIZE; i++)
+        pageref[PA2PG(pa) + i] = 0;
+    buddy_free(pa, MEGAORDER);
+}
+
+// Add a reference to each page of the block from kallocmega()
+// at pa, when fork shares its megapage copy-on-write.
+void kdupmega(void* pa) {
+    for (int i = 0; i < MEGAPGSIZE / PGSIZE; i++)
+        kdup((char*)pa + i * PGSIZE);
+}
+
+// Add a reference to a page that came from kalloc(),
+// e.g. when fork shares it copy-on-write.  Each
+// reference is dropped by its own kfree().
+void kdup(void* pa) {
+    if (((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+        panic("kdup");
+    __sync_fetch_and_add(&pageref[PA2PG(pa)], 1);
+}
+
+// Number of references to a page that came from kalloc().
+int krefcnt(void* pa) {
+    return __atomic_load_n(&pageref[PA2PG(pa)], __ATOMIC_SEQ_CST);
+}
+
+// Report free memory for the memstat() system call.
+void kmemstat(struct memstat* st) {
+    memset(st, 0, sizeof(*st));
+    for (int i = 0; i < NCPU; i++) {
+        acquire(&kmems[i].lock);
+        st->cachedpages += kmems[i].nfree + kmems[i].nzero;
+        st->zeropages += kmems[i].nzero;
+        release(&kmems[i].lock);
+    }
+    buddy_stat(st);
+    st->freepages += st->cachedpages;
 }
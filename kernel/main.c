@@ -28,6 +28,8 @@ void main() {
         //! 开启了分页机制
         kvminithart();  // turn on paging
 
+        asidinit();  // find out how many ASIDs the harts have
+
         //! 初始化进程表，将每个进程的内核栈都指向kvminit时分配的虚拟地址
         //! 注意这里用的还是内核的页表
         procinit();  // process table
@@ -67,8 +69,17 @@ void main() {
         //! 包括对 read /  write的分发 (设备 / inode / pipe)
         fileinit();  // file table
 
+        pipeinit();  // pipe buffers
+
+        shminit();  // shared memory objects
+
+        futexinit();  // futex wait queues
+
         virtio_disk_init();  // emulated hard disk
 
+        //! 磁盘上文件系统之后的交换区, 内存不够时用户页换出到这里
+        swapinit();  // swap area
+
         //! userinit 中会启动第一个用户进程(加入 PCB 中，做出仿佛是刚 fork 出来的样子)
         //! 在 alloc proc 结束时，都会将 ra 设置为 forkret
         //! 这样，当一个新进程第一次执行时，就会跳入 forkret 并直接进入 usertrap, 从而设置 stvec
@@ -31,6 +31,14 @@
 #define CLINT 0x2000000L
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8 * (hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8)  // cycles since boot.
+#define CLINT_MSIP(hartid) (CLINT + 4 * (hartid))  // raises a software interrupt.
+
+// cycles of the time CSR (CLINT_MTIME) per clock tick;
+// about 1/10th second in qemu.
+#define TICKCYCLES 1000000
+
+// cycles of the time CSR per second in qemu.
+#define TIMEFREQ 10000000
 
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
@@ -49,6 +57,12 @@
 #define KERNBASE 0x80000000L
 #define PHYSTOP (KERNBASE + 128 * 1024 * 1024)
 
+// physical pages are numbered from KERNBASE, for the
+// allocators' per-page bookkeeping.
+#define NPHYSPAGES ((PHYSTOP - KERNBASE) / PGSIZE)
+#define PA2PG(pa) (((uint64)(pa)-KERNBASE) / PGSIZE)
+#define PG2PA(i) (KERNBASE + (uint64)(i)*PGSIZE)
+
 // map the trampoline page to the highest address,
 // in both user and kernel space.
 #define TRAMPOLINE (MAXVA - PGSIZE)
@@ -64,8 +78,15 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
-//   TRAPFRAME (p->trapframe, used by the trampoline)
+//   mmap() regions, allocated downwards from MMAPTOP
+//   ...
+//   VDSO (struct vdso in vdso.h, read-only for user code)
+//   TRAPFRAME(i) (proc[i].trapframe, used by the trampoline),
+//     one page per proc slot, so that the threads sharing a
+//     page table (clone()) each have their own; room for 1024
 //   TRAMPOLINE (the same page as in the kernel)
-#define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define TRAPFRAME(i) (TRAMPOLINE - ((uint64)(i) + 1) * PGSIZE)
+#define VDSO TRAPFRAME(1024)
+#define MMAPTOP (VDSO - 1024 * PGSIZE)
 
 #endif  // MEM_LAYOUT_H
@@ -0,0 +1,19 @@
+#ifndef MEMSTAT_H
+#define MEMSTAT_H
+
+#include "param.h"
+#include "types.h"
+
+// Physical memory statistics, filled in by the memstat() system call.
+struct memstat {
+    uint64 freepages;            // Free pages, including per-CPU cached pages
+    uint64 cachedpages;          // Free pages sitting on per-CPU lists
+    uint64 zeropages;            // Of those, pages already zeroed for kzalloc()
+    uint64 nfree[MAXORDER + 1];  // Free buddy blocks of each order
+    uint64 swapused;             // Swap slots holding a page
+    uint64 swapfree;             // Free swap slots
+    uint64 swapins;              // Pages read back from swap since boot
+    uint64 swapouts;             // Pages written to swap since boot
+};
+
+#endif
@@ -4,8 +4,6 @@
 #define NPROC 64                   // maximum number of processes
 #define NCPU 8                     // maximum number of CPUs
 #define NOFILE 16                  // open files per process
-#define NFILE 100                  // open files per system
-#define NINODE 50                  // maximum number of active i-nodes
 #define NDEV 10                    // maximum major device number
 #define ROOTDEV 1                  // device number of file system root disk
 #define MAXARG 32                  // max exec arguments
@@ -14,5 +12,12 @@
 #define NBUF (MAXOPBLOCKS * 3)     // size of disk block cache
 #define FSSIZE 2000                // size of file system in blocks
 #define MAXPATH 128                // maximum file path name
+#define MAXORDER 10                // largest buddy block is 2^MAXORDER pages
+#define NVMA 16                    // file-backed memory regions per process
+#define THPMIN (4 * 1024 * 1024)   // heaps at least this big get 2 MB pages
+#define NSWAPPAGES 8192            // pages in the swap area after the file system
+#define NSHM 16                    // shared memory objects
+#define SHMNAME 16                 // longest shared memory object name, with its 0
+#define NPRIO 3                    // scheduling priorities, 0 is the highest
 
 #endif  // __PARAM_H__
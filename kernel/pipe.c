@@ -5,6 +5,7 @@
 #include "proc.h"
 #include "riscv.h"
 #include "sleeplock.h"
+#include "slab.h"
 #include "spinlock.h"
 #include "types.h"
 
@@ -22,6 +23,13 @@ struct pipe {
     int writeopen;  // write fd is still open
 };
 
+//! pipe 只有五百多字节，从 slab 中分配，一页可以放下好几个
+struct kmem_cache pipecache;
+
+void pipeinit(void) {
+    kmem_cache_init(&pipecache, "pipe", sizeof(struct pipe));
+}
+
 //! 新建俩个打开文件作为 pipe 的输入输出文件
 //! 这里可以看出，file 并不一定指向文件系统的INODE
 //! 还可以指向内存中的管道或是设备, 文件是一个抽象的概念
@@ -34,7 +42,7 @@ int pipealloc(struct file** f0, struct file** f1) {
     //! resource allocate
     if ((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
         goto bad;
-    if ((pi = (struct pipe*)kalloc()) == 0)
+    if ((pi = (struct pipe*)kmem_cache_alloc(&pipecache)) == 0)
         goto bad;
 
     //! init pipe data
@@ -59,7 +67,7 @@ int pipealloc(struct file** f0, struct file** f1) {
 
 bad:
     if (pi)
-        kfree((char*)pi);
+        kmem_cache_free(&pipecache, pi);
     if (*f0)
         fileclose(*f0);
     if (*f1)
@@ -78,7 +86,7 @@ void pipeclose(struct pipe* pi, int writable) {
     }
     if (pi->readopen == 0 && pi->writeopen == 0) {
         release(&pi->lock);
-        kfree((char*)pi);
+        kmem_cache_free(&pipecache, pi);
     } else
         release(&pi->lock);
 }
@@ -106,7 +114,7 @@ int pipewrite(struct pipe* pi, uint64 addr, int n) {
         } else {
             //! 从用户空间复制内容到内核空间的 pipe buffer 中
             char ch;
-            if (copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+            if (copyin(pr->mm->pagetable, &ch, addr + i, 1) == -1)
                 break;
             pi->data[pi->nwrite++ % PIPESIZE] = ch;
             i++;
@@ -138,7 +146,7 @@ int piperead(struct pipe* pi, uint64 addr, int n) {
         if (pi->nread == pi->nwrite)
             break;
         ch = pi->data[pi->nread++ % PIPESIZE];
-        if (copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+        if (copyout(pr->mm->pagetable, addr + i, &ch, 1) == -1)
             break;
     }
     wakeup(&pi->nwrite);  // DOC: piperead-wakeup
@@ -1,10 +1,14 @@
 #include "proc.h"
 #include "defs.h"
+#include "fcntl.h"
 #include "memlayout.h"
 #include "param.h"
 #include "riscv.h"
+#include "sleeplock.h"
+#include "slab.h"
 #include "spinlock.h"
 #include "types.h"
+#include "vdso.h"
 
 struct cpu cpus[NCPU];
 
@@ -16,12 +20,83 @@ int nextpid = 1;
 
 struct spinlock pid_lock;
 
+// processes by pid, for kill() and friends, chained through
+// p->pidnext; protected by pid_lock.  pids are not reused.
+#define NPIDHASH NPROC
+static struct proc* pidhash[NPIDHASH];
+
+// struct mm objects.
+struct kmem_cache mmcache;
+
 extern void forkret(void);
 
 static void freeproc(struct proc* p);
+static void setrunnable(struct proc* p);
+static void kick(int id);
+static void kickidle(int me);
 
 extern char trampoline[];  // trampoline.S
 
+// the page mapped at VDSO in every user page table.
+struct vdso* vdso;
+
+// fail to compile (an array of size -1) if struct vdso
+// outgrows its page, or if the TRAPFRAME(i) pages, one per
+// proc slot, run into VDSO; see memlayout.h.
+typedef char vdso_fits_page[sizeof(struct vdso) <= PGSIZE ? 1 : -1];
+typedef char trapframes_fit[NPROC <= 1024 ? 1 : -1];
+
+// Per-CPU run queues.  A RUNNABLE process sits on the queue
+// of the hart it last ran on, in FIFO order; a hart whose
+// queue is empty steals from the longest other one.  Lock
+// order: p->lock before a queue's lock.
+//
+// Built with SCHED_MLFQ, each queue has a level per priority
+// (a multi-level feedback queue): a hart runs the processes
+// of its highest non-empty level, a process that uses up its
+// level's time slice moves down a level, and every BOOSTTICKS
+// ticks everyone moves back up to the level of its priority,
+// so that CPU-bound processes sink below interactive ones but
+// do not starve.  Otherwise there is one level and the
+// processes take turns, a tick at a time.
+#ifdef SCHED_MLFQ
+#define NLEVEL NPRIO
+#else
+#define NLEVEL 1
+#endif
+
+// ticks between priority boosts.
+#define BOOSTTICKS 20
+
+// time slice of a level, in ticks.
+#define SLICE(level) (1 << (level))
+
+struct runq {
+    struct spinlock lock;
+    struct proc* head[NLEVEL];
+    struct proc* tail[NLEVEL];
+    int n;       // length, read without the lock as a hint
+    uint boost;  // boost period applied to the queued processes
+};
+
+struct runq runqs[NCPU];
+
+// Sleep queues: the processes in sleep() on the channels
+// that hash to a queue, so that wakeup() only looks at those.
+// A queue's lock is acquired before any p->lock.
+#define NSLEEPQ 61
+
+struct sleepq {
+    struct spinlock lock;
+    struct proc* head;
+};
+
+struct sleepq sleepqs[NSLEEPQ];
+
+static struct sleepq* sleepq(void* chan) {
+    return &sleepqs[((uint64)chan >> 3) % NSLEEPQ];
+}
+
 // helps ensure that wakeups of wait()ing
 // parents are not lost. helps obey the
 // memory model when using p->parent.
@@ -52,10 +127,21 @@ void procinit(void) {
 
     initlock(&pid_lock, "nextpid");
     initlock(&wait_lock, "wait_lock");
+    kmem_cache_init(&mmcache, "mm", sizeof(struct mm));
+    for (int i = 0; i < NCPU; i++)
+        initlock(&runqs[i].lock, "runq");
+    for (int i = 0; i < NSLEEPQ; i++)
+        initlock(&sleepqs[i].lock, "sleepq");
+    if ((vdso = (struct vdso*)kalloc()) == 0)
+        panic("procinit: vdso");
+    memset(vdso, 0, PGSIZE);
+    vdso->timefreq = TIMEFREQ;
+    vdso->tickcycles = TICKCYCLES;
     for (p = proc; p < &proc[NPROC]; p++) {
         initlock(&p->lock, "proc");
         p->state = UNUSED;
         p->kstack = KSTACK((int)(p - proc));
+        p->timer = -1;
     }
 }
 
@@ -84,15 +170,51 @@ struct proc* myproc(void) {
     return p;
 }
 
-int allocpid() {
-    int pid;
+// Give p a new pid and enter it in the pid hash.
+void allocpid(struct proc* p) {
+    struct proc** h;
 
     acquire(&pid_lock);
-    pid = nextpid;
+    p->pid = nextpid;
     nextpid = nextpid + 1;
+    h = &pidhash[p->pid % NPIDHASH];
+    p->pidnext = *h;
+    *h = p;
     release(&pid_lock);
+}
 
-    return pid;
+// Take p out of the pid hash.
+static void freepid(struct proc* p) {
+    struct proc** pp;
+
+    acquire(&pid_lock);
+    for (pp = &pidhash[p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->pidnext)
+        ;
+    *pp = p->pidnext;
+    release(&pid_lock);
+}
+
+// Return the process with the given pid, with its lock
+// held, or 0 if there is none.
+static struct proc* findproc(int pid) {
+    struct proc* p;
+
+    if (pid <= 0)
+        return 0;
+    acquire(&pid_lock);
+    for (p = pidhash[pid % NPIDHASH]; p && p->pid != pid; p = p->pidnext)
+        ;
+    release(&pid_lock);
+    if (p == 0)
+        return 0;
+    //! freeproc() 拿着 p->lock 再拿 pid_lock, 所以这里要先放掉 pid_lock;
+    //! 中间 p 可能被回收了, pid 不重用, 所以 pid 变了就说明进程已经没了
+    acquire(&p->lock);
+    if (p->pid != pid) {
+        release(&p->lock);
+        return 0;
+    }
+    return p;
 }
 
 // Look in the process table for an UNUSED proc.
@@ -115,8 +237,19 @@ static struct proc* allocproc(void) {
     return 0;
 
 found:
-    p->pid = allocpid();
+    allocpid(p);
+    vdso->pid[p - proc] = p->pid;
     p->state = USED;
+    p->cpu = -1;
+    //! 子进程继承父进程的优先级
+    p->prio = myproc() ? myproc()->prio : 0;
+    p->level = p->prio;
+    p->ticks = 0;
+    p->boost = ticks / BOOSTTICKS;
+    p->mm = 0;
+    p->pinva = MAXVA;
+    p->pfstart = p->pfend = 0;
+    p->sleeplocks = 0;
 
     // Allocate a trapframe page.
     //! 申请一个 trapframe page, 用于之后在用户态和内核态之间切换时保存上下文
@@ -126,18 +259,8 @@ found:
         return 0;
     }
 
-    // An empty user page table.
-
-    //! 申请页表，并暂时先映射 trampoline 和 trapframe
-    //! 这里分配后，.text 段和 .data 段都没有映射到用户空间
-    //! 如果是在 fork 调用的，fork 会负责复制父进程的所有内容
-    //! 如果是第一个进程，会手动将 initcode 进行简单的映射
-    p->pagetable = proc_pagetable(p);
-    if (p->pagetable == 0) {
-        freeproc(p);
-        release(&p->lock);
-        return 0;
-    }
+    //! 地址空间 (p->mm) 由调用者给: fork 复制一份, clone 共用一份,
+    //! exec 和 spawn 从程序文件新建一份
 
     // Set up new context to start executing at forkret,
     // which returns to user space.
@@ -148,29 +271,31 @@ found:
     return p;
 }
 
-// free a proc structure and the data hanging from it,
-// including user pages.
+// free a proc structure and the data hanging from it.
+// Its address space must have been dropped already,
+// by exit() or with mmput().
 // p->lock must be held.
 static void freeproc(struct proc* p) {
+    if (p->mm)
+        panic("freeproc mm");
     if (p->trapframe)
         kfree((void*)p->trapframe);
     p->trapframe = 0;
-    if (p->pagetable)
-        proc_freepagetable(p->pagetable, p->sz);
-    p->pagetable = 0;
-    p->sz = 0;
+    vdso->pid[p - proc] = 0;
+    freepid(p);
     p->pid = 0;
     p->parent = 0;
     p->name[0] = 0;
     p->chan = 0;
     p->killed = 0;
     p->xstate = 0;
+    p->pgfaults = 0;
     p->state = UNUSED;
 }
 
 // Create a user page table for a given process, with no user memory,
-// but with trampoline and trapframe pages.
-pagetable_t proc_pagetable(struct proc* p) {
+// but with trampoline, trapframe and vdso pages.
+static pagetable_t proc_pagetable(struct proc* p) {
     pagetable_t pagetable;
 
     // An empty page table.
@@ -187,10 +312,21 @@ pagetable_t proc_pagetable(struct proc* p) {
         return 0;
     }
 
-    // map the trapframe page just below the trampoline page, for
-    // trampoline.S.
-    if (mappages(pagetable, TRAPFRAME, PGSIZE, (uint64)(p->trapframe), PTE_R | PTE_W) < 0) {
+    // map the trapframe page below the trampoline page, for
+    // trampoline.S; each proc slot has its own address there,
+    // since threads of one address space share the page table.
+    if (mappages(pagetable, TRAPFRAME(p - proc), PGSIZE, (uint64)(p->trapframe), PTE_R | PTE_W) < 0) {
+        uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+        uvmfree(pagetable, 0);
+        return 0;
+    }
+
+    // map the vdso page below the trapframes, read-only, for
+    // user code that wants the time or its pid without a
+    // system call.
+    if (mappages(pagetable, VDSO, PGSIZE, (uint64)vdso, PTE_R | PTE_U) < 0) {
         uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+        uvmunmap(pagetable, TRAPFRAME(p - proc), 1, 0);
         uvmfree(pagetable, 0);
         return 0;
     }
@@ -198,12 +334,86 @@ pagetable_t proc_pagetable(struct proc* p) {
     return pagetable;
 }
 
-// Free a process's page table, and free the
-// physical memory it refers to.
-void proc_freepagetable(pagetable_t pagetable, uint64 sz) {
-    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-    uvmunmap(pagetable, TRAPFRAME, 1, 0);
-    uvmfree(pagetable, sz);
+// Create an address space for p, with one reference: an
+// empty page table that maps the trampoline and p's
+// trapframe, and no regions.
+// Returns 0 if there is no memory.
+struct mm* mmalloc(struct proc* p) {
+    struct mm* mm;
+
+    if ((mm = kmem_cache_alloc(&mmcache)) == 0)
+        return 0;
+    memset(mm, 0, sizeof(*mm));
+    initsleeplock(&mm->lock, "mm");
+    mm->ref = 1;
+    if ((mm->pagetable = proc_pagetable(p)) == 0) {
+        kmem_cache_free(&mmcache, mm);
+        return 0;
+    }
+    return mm;
+}
+
+// Free an address space that p was the last to use, its page
+// table, and the physical memory it refers to.  Its regions
+// must have been dropped already.
+void mmfree(struct mm* mm, struct proc* p) {
+    uvmunmap(mm->pagetable, TRAMPOLINE, 1, 0);
+    uvmunmap(mm->pagetable, TRAPFRAME(p - proc), 1, 0);
+    uvmunmap(mm->pagetable, VDSO, 1, 0);
+    uvmfree(mm->pagetable, mm->sz);
+    kmem_cache_free(&mmcache, mm);
+}
+
+// Drop p's reference to its address space.  The last one
+// unmaps the regions, writing MAP_SHARED file pages back,
+// and frees it; otherwise only p's trapframe is unmapped.
+// Must not be called inside a transaction.
+void mmput(struct proc* p) {
+    struct mm* mm = p->mm;
+    int last;
+
+    acquiresleep(&mm->lock);
+    last = mm->ref == 1;
+    if (!last)
+        uvmunmap(mm->pagetable, TRAPFRAME(p - proc), 1, 0);
+    p->mm = 0;
+    if (p == myproc())
+        asidleave();
+    mm->ref--;
+    releasesleep(&mm->lock);
+
+    if (last) {
+        //! 已经没有别的线程了, vmaunmap() 不用再拿锁
+        vmaunmap(mm, 0, MAXVA);
+        mmfree(mm, p);
+    }
+}
+
+// Lock mm against the other threads that share it, and
+// against reclaim() in swap.c, before changing its regions
+// or page table.  reclaim() never waits for mm->lock; it
+// leaves a locked address space alone.  Returns -1, without
+// locking, if mm is shared and the caller holds a spinlock
+// or another sleep-lock: a thread may hold mm->lock while it
+// waits for an inode or the disk, so waiting for mm->lock
+// there could deadlock.  Such callers fault their user
+// buffers in first, with vmaprefault().  A caller with a
+// spinlock and mm to itself locks nothing: it cannot be
+// preempted, so reclaim() cannot catch it halfway.
+int mmlock(struct mm* mm) {
+    if (!cansleep())
+        return mm->ref > 1 ? -1 : 0;
+    if (mm->ref > 1 && myproc()->sleeplocks > 0)
+        return -1;
+    //! 只有一个线程时没有人会持有这把锁, 拿着别的睡眠锁也不会等
+    acquiresleep(&mm->lock);
+    return 0;
+}
+
+// Undo mmlock().
+void mmunlock(struct mm* mm) {
+    if (holdingsleep(&mm->lock))
+        releasesleep(&mm->lock);
 }
 
 // a user program that calls exec("/init")
@@ -223,8 +433,10 @@ void userinit(void) {
 
     // allocate one user page and copy initcode's instructions
     // and data into it.
-    uvmfirst(p->pagetable, initcode, sizeof(initcode));
-    p->sz = PGSIZE;
+    if ((p->mm = mmalloc(p)) == 0)
+        panic("userinit");
+    uvmfirst(p->mm->pagetable, initcode, sizeof(initcode));
+    p->mm->sz = PGSIZE;
 
     // prepare for the very first "return" from kernel to user.
     p->trapframe->epc = 0;      // user program counter
@@ -233,27 +445,46 @@ void userinit(void) {
     safestrcpy(p->name, "initcode", sizeof(p->name));
     p->cwd = namei("/");
 
-    p->state = RUNNABLE;
+    setrunnable(p);
 
     release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int growproc(int n) {
-    uint64 sz;
-    struct proc* p = myproc();
+// Return the old size on success, -1 on failure.
+uint64 growproc(int n) {
+    struct mm* mm = myproc()->mm;
+    uint64 sz, oldsz;
 
-    sz = p->sz;
+    if (mmlock(mm) < 0)
+        return -1;
+    sz = oldsz = mm->sz;
     if (n > 0) {
-        if ((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
-            return -1;
-        }
+        //! 只扩大 sz, 物理页在第一次访问时由 vmfault() 分配
+        //! 不能长进 mmap 的区域
+        if (sz + n < sz || sz + n > vmalimit(mm))
+            goto bad;
+        sz += n;
     } else if (n < 0) {
-        sz = uvmdealloc(p->pagetable, sz, sz + n);
+        //! 只有在拆分超级页时没有内存才会失败
+        if ((sz = uvmdealloc(mm->pagetable, sz, sz + n)) == oldsz)
+            goto bad;
     }
-    p->sz = sz;
-    return 0;
+    mm->sz = sz;
+    mmunlock(mm);
+    return oldsz;
+
+bad:
+    mmunlock(mm);
+    return -1;
+}
+
+// Make np a child of p.
+// Caller must hold wait_lock.
+static void setparent(struct proc* np, struct proc* p) {
+    np->parent = p;
+    np->sibling = p->children;
+    p->children = np;
 }
 
 // Create a new process, copying the parent.
@@ -262,20 +493,31 @@ int fork(void) {
     int i, pid;
     struct proc* np;
     struct proc* p = myproc();
+    struct mm* mm = p->mm;
 
     // Allocate process.
     if ((np = allocproc()) == 0) {
         return -1;
     }
+    //! 复制时可能要等其他 hart 刷 TLB, 不能拿着自旋锁
+    //! np 的状态是 USED, 没有人会动它
+    release(&np->lock);
 
-    // Copy user memory from parent to child.
-    if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0) {
-        freeproc(np);
-        release(&np->lock);
-        return -1;
-    }
+    if ((np->mm = mmalloc(np)) == 0 || mmlock(mm) < 0)
+        goto bad;
 
-    np->sz = p->sz;
+    // Populate shared mappings, so parent and child see the same pages,
+    // then copy user memory from parent to child.
+    if (vmashare(mm) < 0 || uvmcopy(mm->pagetable, np->mm->pagetable, mm->sz) < 0) {
+        mmunlock(mm);
+        goto bad;
+    }
+    if (vmacopy(np->mm, mm) < 0) {
+        mmunlock(mm);
+        goto bad;
+    }
+    np->mm->sz = mm->sz;
+    mmunlock(mm);
 
     // copy saved user registers.
     *(np->trapframe) = *(p->trapframe);
@@ -293,14 +535,161 @@ int fork(void) {
 
     pid = np->pid;
 
+    acquire(&wait_lock);
+    setparent(np, p);
+    release(&wait_lock);
+
+    acquire(&np->lock);
+    setrunnable(np);
+    release(&np->lock);
+
+    return pid;
+
+bad:
+    if (np->mm)
+        mmput(np);
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+}
+
+// Create a thread: a new process that shares the caller's
+// address space, and starts at fn(arg) on the given user
+// stack, which must be 16-byte aligned.  fn must not return,
+// but call exit().  The thread gets copies of the caller's
+// file descriptors and current directory, which refer to
+// the same open files; it is the caller's child, and is
+// reaped with wait().  Returns the thread's pid, or -1.
+int clone(uint64 fn, uint64 arg, uint64 stack) {
+    struct proc* p = myproc();
+    struct mm* mm = p->mm;
+    struct proc* np;
+    int i, pid;
+
+    if (stack % 16 != 0)
+        return -1;
+    if ((np = allocproc()) == 0)
+        return -1;
     release(&np->lock);
 
+    //! 共用的页表中再映射一个 trapframe, 每个线程一页
+    acquiresleep(&mm->lock);
+    if (mappages(mm->pagetable, TRAPFRAME(np - proc), PGSIZE, (uint64)np->trapframe, PTE_R | PTE_W) < 0) {
+        releasesleep(&mm->lock);
+        acquire(&np->lock);
+        freeproc(np);
+        release(&np->lock);
+        return -1;
+    }
+    mm->ref++;
+    np->mm = mm;
+    releasesleep(&mm->lock);
+
+    *(np->trapframe) = *(p->trapframe);
+    np->trapframe->epc = fn;
+    np->trapframe->a0 = arg;
+    np->trapframe->sp = stack;
+    np->trapframe->ra = 0;
+
+    for (i = 0; i < NOFILE; i++)
+        if (p->ofile[i])
+            np->ofile[i] = filedup(p->ofile[i]);
+    np->cwd = idup(p->cwd);
+
+    safestrcpy(np->name, p->name, sizeof(p->name));
+
+    pid = np->pid;
+
     acquire(&wait_lock);
-    np->parent = p;
+    setparent(np, p);
+    release(&wait_lock);
+
+    acquire(&np->lock);
+    setrunnable(np);
+    release(&np->lock);
+
+    return pid;
+}
+
+// Apply spawn() file actions to the open files of np.
+// Returns 0 on success, -1 if an action is invalid.
+static int spawnfiles(struct proc* np, struct spawnact* acts, int nact) {
+    struct spawnact* a;
+    struct file* f;
+
+    for (a = acts; a < &acts[nact]; a++) {
+        if (a->fd < 0 || a->fd >= NOFILE)
+            return -1;
+        if (a->op == SPAWN_DUP2) {
+            if (np->ofile[a->fd] == 0 || a->newfd < 0 || a->newfd >= NOFILE)
+                return -1;
+            if (a->newfd == a->fd)
+                continue;
+            f = filedup(np->ofile[a->fd]);
+            if (np->ofile[a->newfd])
+                fileclose(np->ofile[a->newfd]);
+            np->ofile[a->newfd] = f;
+        } else if (a->op == SPAWN_CLOSE) {
+            if (np->ofile[a->fd])
+                fileclose(np->ofile[a->fd]);
+            np->ofile[a->fd] = 0;
+        } else {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Create a new process running the program at path with
+// arguments argv, like fork() followed by exec() in the child,
+// but without copying the caller's memory: execproc() builds
+// the child's memory straight from the program file.  The
+// child gets the caller's open files, changed by the nact
+// file actions in acts.  Returns the child's pid, or -1.
+int spawn(char* path, char** argv, struct spawnact* acts, int nact) {
+    struct proc* p = myproc();
+    struct proc* np;
+    int i, pid, argc;
+
+    if ((np = allocproc()) == 0)
+        return -1;
+    //! 读程序文件会睡眠, 不能拿着锁
+    //! np 的状态是 USED, 没有人会动它
+    release(&np->lock);
+
+    for (i = 0; i < NOFILE; i++)
+        if (p->ofile[i])
+            np->ofile[i] = filedup(p->ofile[i]);
+    np->cwd = idup(p->cwd);
+    memset(np->trapframe, 0, sizeof(*np->trapframe));
+
+    if (spawnfiles(np, acts, nact) < 0 || (argc = execproc(np, path, argv)) < 0) {
+        for (i = 0; i < NOFILE; i++) {
+            if (np->ofile[i])
+                fileclose(np->ofile[i]);
+            np->ofile[i] = 0;
+        }
+        begin_op();
+        iput(np->cwd);
+        end_op();
+        np->cwd = 0;
+        acquire(&np->lock);
+        freeproc(np);
+        release(&np->lock);
+        return -1;
+    }
+    //! 和 exec 一样, argc 放在 a0 中
+    np->trapframe->a0 = argc;
+
+    pid = np->pid;
+
+    acquire(&wait_lock);
+    setparent(np, p);
     release(&wait_lock);
 
     acquire(&np->lock);
-    np->state = RUNNABLE;
+    setrunnable(np);
     release(&np->lock);
 
     return pid;
@@ -311,12 +700,18 @@ int fork(void) {
 void reparent(struct proc* p) {
     struct proc* pp;
 
-    for (pp = proc; pp < &proc[NPROC]; pp++) {
-        if (pp->parent == p) {
-            pp->parent = initproc;
-            wakeup(initproc);
-        }
+    if (p->children == 0)
+        return;
+    for (pp = p->children;; pp = pp->sibling) {
+        pp->parent = initproc;
+        if (pp->sibling == 0)
+            break;
     }
+    //! 整条子进程链表接到 init 的前面
+    pp->sibling = initproc->children;
+    initproc->children = p->children;
+    p->children = 0;
+    wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
@@ -338,6 +733,10 @@ void exit(int status) {
         }
     }
 
+    // Drop the address space; the last thread to do so unmaps
+    // all regions, writing back MAP_SHARED file pages.
+    mmput(p);
+
     begin_op();
     iput(p->cwd);
     end_op();
@@ -366,43 +765,40 @@ void exit(int status) {
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
 int wait(uint64 addr) {
-    struct proc* pp;
-    int havekids, pid;
+    struct proc *pp, **link;
+    int pid;
     struct proc* p = myproc();
 
     acquire(&wait_lock);
 
     for (;;) {
-        // Scan through table looking for exited children.
-        havekids = 0;
-        for (pp = proc; pp < &proc[NPROC]; pp++) {
-            if (pp->parent == p) {
-                // make sure the child isn't still in exit() or swtch().
-                acquire(&pp->lock);
-
-                havekids = 1;
-                //! 如果子进程已经ZOMBIE,负责 copy 子进程的状态码到用户态空间,并回收
-                if (pp->state == ZOMBIE) {
-                    // Found one.
-                    pid = pp->pid;
-                    if (addr != 0 &&
-                        copyout(p->pagetable, addr, (char*)&pp->xstate, sizeof(pp->xstate)) < 0) {
-                        release(&pp->lock);
-                        release(&wait_lock);
-                        return -1;
-                    }
-                    freeproc(pp);
+        // Scan through our children looking for exited ones.
+        for (link = &p->children; (pp = *link) != 0; link = &pp->sibling) {
+            // make sure the child isn't still in exit() or swtch().
+            acquire(&pp->lock);
+
+            //! 如果子进程已经ZOMBIE,负责 copy 子进程的状态码到用户态空间,并回收
+            if (pp->state == ZOMBIE) {
+                // Found one.
+                pid = pp->pid;
+                if (addr != 0 &&
+                    copyout(p->mm->pagetable, addr, (char*)&pp->xstate, sizeof(pp->xstate)) < 0) {
                     release(&pp->lock);
                     release(&wait_lock);
-                    //! 返回子进程 PID
-                    return pid;
+                    return -1;
                 }
+                *link = pp->sibling;
+                freeproc(pp);
                 release(&pp->lock);
+                release(&wait_lock);
+                //! 返回子进程 PID
+                return pid;
             }
+            release(&pp->lock);
         }
 
         // No point waiting if we don't have any children.
-        if (!havekids || killed(p)) {
+        if (p->children == 0 || killed(p)) {
             release(&wait_lock);
             return -1;
         }
@@ -412,10 +808,202 @@ int wait(uint64 addr) {
     }
 }
 
+// Append p to rq at its level.  Caller must hold rq->lock.
+static void enqueue(struct runq* rq, struct proc* p) {
+    int l = NLEVEL > 1 ? p->level : 0;
+
+    p->rqnext = 0;
+    if (rq->tail[l])
+        rq->tail[l]->rqnext = p;
+    else
+        rq->head[l] = p;
+    rq->tail[l] = p;
+}
+
+// Mark p RUNNABLE and put it at the tail of the run queue
+// of the hart it last ran on, or of this hart if it never ran.
+// Caller must hold p->lock.
+static void setrunnable(struct proc* p) {
+    struct runq* rq = &runqs[p->cpu >= 0 ? p->cpu : cpuid()];
+
+    p->state = RUNNABLE;
+    //! 错过了提升就现在补上
+    if (p->boost != ticks / BOOSTTICKS) {
+        p->boost = ticks / BOOSTTICKS;
+        p->level = p->prio;
+        p->ticks = 0;
+    }
+    acquire(&rq->lock);
+    enqueue(rq, p);
+    rq->n++;
+    release(&rq->lock);
+    //! yield() 把自己放回本 hart 的队列, 马上就会被本 hart 选中, 不用叫醒谁
+    if (p != myproc())
+        kick(rq - runqs);
+}
+
+// Wake up a hart for a process just woken, forked or killed
+// onto hart id's run queue: hart id if it is idle, or else
+// some other idle hart, which will steal the process rather
+// than let it wait for id's next tick.  This hart needs no
+// IPI when it is in the scheduler and will look anyway.
+static void kick(int id) {
+    int me = cpuid();
+
+    //! 抢到 idle 标志的才发 IPI, 同一个 hart 不会被叫醒好几次
+    if (id != me && __sync_bool_compare_and_swap(&cpus[id].idle, 1, 0)) {
+        ipi(id);
+        return;
+    }
+    if (id == me && mycpu()->proc == 0)
+        return;
+    kickidle(me);
+}
+
+// Wake up one idle hart other than me, if there is one, to
+// steal from me's run queue.
+static void kickidle(int me) {
+    for (int i = 0; i < NCPU; i++) {
+        if (i != me && __sync_bool_compare_and_swap(&cpus[i].idle, 1, 0)) {
+            ipi(i);
+            return;
+        }
+    }
+}
+
+// Stall this hart, which found nothing to run, until an
+// interrupt: a timer (see timerset()), a device, or an IPI
+// from kick().  The
+// queues are looked at again after c->idle is set, so that a
+// process queued meanwhile is not missed; and wfi runs with
+// interrupts off, so that one that arrives in between makes
+// it return at once, to be taken when the scheduler turns
+// interrupts back on.
+static void idle(struct cpu* c) {
+    int i;
+
+    intr_off();
+    c->idle = 1;
+    __sync_synchronize();
+    for (i = 0; i < NCPU; i++) {
+        if (__atomic_load_n(&runqs[i].n, __ATOMIC_RELAXED) > 0)
+            break;
+    }
+    if (i == NCPU) {
+        //! 空闲的 hart 不需要时钟, 只在最早的睡眠者到期时醒来
+        timerset();
+        wfi();
+    }
+    c->idle = 0;
+}
+
+// Move the processes of rq that are below the level of their
+// priority back up, if a boost period began since the last
+// time.  Caller must hold rq->lock.
+static void boost(struct runq* rq) {
+    struct proc *list = 0, **tail = &list, *p;
+    uint b = ticks / BOOSTTICKS;
+
+    if (NLEVEL == 1 || rq->boost == b)
+        return;
+    rq->boost = b;
+    for (int l = 1; l < NLEVEL; l++) {
+        if (rq->head[l]) {
+            *tail = rq->head[l];
+            tail = &rq->tail[l]->rqnext;
+            rq->head[l] = rq->tail[l] = 0;
+        }
+    }
+    while ((p = list) != 0) {
+        list = p->rqnext;
+        p->boost = b;
+        p->level = p->prio;
+        p->ticks = 0;
+        enqueue(rq, p);
+    }
+}
+
+// Take the process at the head of the highest non-empty
+// level of rq off it.
+// Returns 0 if rq is empty.
+static struct proc* dequeue(struct runq* rq) {
+    struct proc* p = 0;
+
+    acquire(&rq->lock);
+    boost(rq);
+    for (int l = 0; l < NLEVEL; l++) {
+        if ((p = rq->head[l]) != 0) {
+            if ((rq->head[l] = p->rqnext) == 0)
+                rq->tail[l] = 0;
+            rq->n--;
+            break;
+        }
+    }
+    release(&rq->lock);
+    return p;
+}
+
+// Choose a process for hart id: the head of its own run
+// queue, or else the head of the longest other one.
+// Returns 0 if nothing is runnable.
+static struct proc* pickproc(int id) {
+    struct proc* p;
+    int i, best = -1, n = 0;
+
+    if ((p = dequeue(&runqs[id])) != 0)
+        return p;
+    //! 本 hart 没事做了, 从最长的队列偷一个; 长度不加锁读, 只是个提示
+    for (i = 0; i < NCPU; i++) {
+        if (i != id && runqs[i].n > n) {
+            n = runqs[i].n;
+            best = i;
+        }
+    }
+    return best >= 0 ? dequeue(&runqs[best]) : 0;
+}
+
+// Called on a timer interrupt while the current process
+// runs.  Round-robin, it gives up the CPU.  Under MLFQ it
+// does so when it has used up its level's time slice, which
+// moves it down a level, or when a process of a higher level
+// waits on this hart.  Either way, if processes wait on this
+// hart's queue, an idle hart is woken to take one.
+void preempt(void) {
+    struct proc* p = myproc();
+    struct runq* rq;
+    int l;
+
+    push_off();
+    //! 长度不加锁读, 看错了也只是晚一个 tick
+    if (runqs[cpuid()].n > 0)
+        kickidle(cpuid());
+    pop_off();
+    if (NLEVEL == 1) {
+        yield();
+        return;
+    }
+    if (++p->ticks >= SLICE(p->level)) {
+        if (p->level < NLEVEL - 1)
+            p->level++;
+        p->ticks = 0;
+        yield();
+        return;
+    }
+    push_off();
+    rq = &runqs[cpuid()];
+    //! 不加锁看一眼, 看错了也只是晚一个 tick
+    for (l = 0; l < p->level && rq->head[l] == 0; l++)
+        ;
+    pop_off();
+    if (l < p->level)
+        yield();
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process off this CPU's run queue, or
+//    steal one from another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -426,31 +1014,49 @@ int wait(uint64 addr) {
 //!
 //! 除此之外，Scheduler 调度时切换的上下文只有栈，因为默认发生scheduler时
 //! CPU 只可能处于内核态, 已经使用内核页表，故不需要换页表，只需要进行内核栈的切换即可
+//!
+//! 不再扫描整个进程表: 可运行的进程都在运行队列上
+//! 没事可做的 hart 用 wfi 停下来, 有进程进了队列再用 IPI 叫醒
 void scheduler(void) {
     struct proc* p;
     struct cpu* c = mycpu();
+    int id = c - cpus;
 
     c->proc = 0;
     for (;;) {
         // Avoid deadlock by ensuring that devices can interrupt.
         intr_on();
 
-        for (p = proc; p < &proc[NPROC]; p++) {
-            acquire(&p->lock);
-            if (p->state == RUNNABLE) {
-                // Switch to chosen process.  It is the process's job
-                // to release its lock and then reacquire it
-                // before jumping back to us.
-                p->state = RUNNING;
-                c->proc = p;
-                swtch(&c->context, &p->context);
-
-                // Process is done running for now.
-                // It should have changed its p->state before coming back.
-                c->proc = 0;
-            }
-            release(&p->lock);
+        // nothing to run: zero a page for kzalloc(), or with
+        // nothing to zero either, wait for an interrupt; then
+        // look again.
+        if ((p = pickproc(id)) == 0) {
+            if (kzeroidle() == 0)
+                idle(c);
+            continue;
         }
+
+        // p is off the queues, so nobody else will run it; its
+        // lock may still be held by the hart that queued it,
+        // until that hart has switched away from it.
+        acquire(&p->lock);
+        if (p->state != RUNNABLE)
+            panic("scheduler");
+        // Switch to chosen process.  It is the process's job
+        // to release its lock and then reacquire it
+        // before jumping back to us.
+        p->state = RUNNING;
+        p->cpu = id;
+        c->proc = p;
+        timerset();
+        asidswitch(p);
+        swtch(&c->context, &p->context);
+
+        // Process is done running for now.
+        // It should have changed its p->state before coming back.
+        c->proc = 0;
+        asidleave();
+        release(&p->lock);
     }
 }
 
@@ -490,7 +1096,7 @@ void sched(void) {
 void yield(void) {
     struct proc* p = myproc();
     acquire(&p->lock);
-    p->state = RUNNABLE;
+    setrunnable(p);
     sched();
     release(&p->lock);
 }
@@ -520,46 +1126,69 @@ void forkret(void) {
 //! chan 只是一个 tag, 用于比较是否是在睡眠的锁
 void sleep(void* chan, struct spinlock* lk) {
     struct proc* p = myproc();
+    struct sleepq* sq = sleepq(chan);
 
     // Must acquire p->lock in order to
     // change p->state and then call sched.
-    // Once we hold p->lock, we can be
+    // Once we hold the sleep queue's lock, we can be
     // guaranteed that we won't miss any wakeup
-    // (wakeup locks p->lock),
+    // (wakeup locks it),
     // so it's okay to release lk.
 
-    acquire(&p->lock);  // DOC: sleeplock1
+    acquire(&sq->lock);  // DOC: sleeplock1
+    acquire(&p->lock);
     release(lk);
 
     // Go to sleep.
     p->chan = chan;
     p->state = SLEEPING;
+    p->sq = sq;
+    p->sqnext = sq->head;
+    sq->head = p;
+    release(&sq->lock);
 
     sched();
 
     // Tidy up.
     p->chan = 0;
+    release(&p->lock);
+
+    //! 被 kill() 叫醒的进程还在队列上, 自己摘下来
+    acquire(&sq->lock);
+    if (p->sq) {
+        struct proc** pp;
+        for (pp = &sq->head; *pp != p; pp = &(*pp)->sqnext)
+            ;
+        *pp = p->sqnext;
+        p->sq = 0;
+    }
+    release(&sq->lock);
 
     // Reacquire original lock.
-    release(&p->lock);
     acquire(lk);
 }
 
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void wakeup(void* chan) {
-    struct proc* p;
+    struct sleepq* sq = sleepq(chan);
+    struct proc *p, **pp;
 
-    //! 遍历整个进程表，修改 SLEEPING 的进程为 RUNNABLE
-    for (p = proc; p < &proc[NPROC]; p++) {
-        if (p != myproc()) {
-            acquire(&p->lock);
-            if (p->state == SLEEPING && p->chan == chan) {
-                p->state = RUNNABLE;
-            }
-            release(&p->lock);
+    //! 只看 chan 散列到的那个队列, 不再遍历整个进程表
+    acquire(&sq->lock);
+    for (pp = &sq->head; (p = *pp) != 0;) {
+        acquire(&p->lock);
+        if (p->chan == chan) {
+            *pp = p->sqnext;
+            p->sq = 0;
+            if (p->state == SLEEPING)
+                setrunnable(p);
+        } else {
+            pp = &p->sqnext;
         }
+        release(&p->lock);
     }
+    release(&sq->lock);
 }
 
 // Kill the process with the given pid.
@@ -568,20 +1197,47 @@ void wakeup(void* chan) {
 int kill(int pid) {
     struct proc* p;
 
-    for (p = proc; p < &proc[NPROC]; p++) {
-        acquire(&p->lock);
-        if (p->pid == pid) {
-            p->killed = 1;
-            if (p->state == SLEEPING) {
-                // Wake process from sleep().
-                p->state = RUNNABLE;
-            }
-            release(&p->lock);
-            return 0;
-        }
-        release(&p->lock);
+    if ((p = findproc(pid)) == 0)
+        return -1;
+    p->killed = 1;
+    if (p->state == SLEEPING) {
+        // Wake process from sleep().
+        setrunnable(p);
     }
-    return -1;
+    release(&p->lock);
+    return 0;
+}
+
+// Set the priority of the process with the given pid, 0 being
+// the highest.  Under MLFQ it is the highest level the process
+// runs at; a sleeping or running process moves there now, a
+// queued one when it is next queued or boosted.  Round-robin
+// scheduling ignores it.  Children inherit it.
+int setpriority(int pid, int prio) {
+    struct proc* p;
+
+    if (prio < 0 || prio >= NPRIO || (p = findproc(pid)) == 0)
+        return -1;
+    p->prio = prio;
+    if (p->state != RUNNABLE || p->level < prio) {
+        p->level = prio;
+        p->ticks = 0;
+    }
+    release(&p->lock);
+    return 0;
+}
+
+// Return the priority of the process with the given pid,
+// or -1 if there is none.
+int getpriority(int pid) {
+    struct proc* p;
+    int prio;
+
+    if ((p = findproc(pid)) == 0)
+        return -1;
+    prio = p->prio;
+    release(&p->lock);
+    return prio;
 }
 
 void setkilled(struct proc* p) {
@@ -605,7 +1261,7 @@ int killed(struct proc* p) {
 int either_copyout(int user_dst, uint64 dst, void* src, uint64 len) {
     struct proc* p = myproc();
     if (user_dst) {
-        return copyout(p->pagetable, dst, src, len);
+        return copyout(p->mm->pagetable, dst, src, len);
     } else {
         memmove((char*)dst, src, len);
         return 0;
@@ -618,7 +1274,7 @@ int either_copyout(int user_dst, uint64 dst, void* src, uint64 len) {
 int either_copyin(void* dst, int user_src, uint64 src, uint64 len) {
     struct proc* p = myproc();
     if (user_src) {
-        return copyin(p->pagetable, dst, src, len);
+        return copyin(p->mm->pagetable, dst, src, len);
     } else {
         memmove(dst, (char*)src, len);
         return 0;
@@ -642,7 +1298,7 @@ void procdump(void) {
             state = states[p->state];
         else
             state = "???";
-        printf("%d %s %s", p->pid, state, p->name);
+        printf("%d %s %s pgfaults=%d", p->pid, state, p->name, p->pgfaults);
         printf("\n");
     }
 }
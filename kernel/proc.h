@@ -4,6 +4,7 @@
 
 #include "param.h"
 #include "riscv.h"
+#include "sleeplock.h"
 #include "spinlock.h"
 #include "types.h"
 
@@ -42,6 +43,11 @@ struct cpu {
     struct context context;  // swtch() here to enter scheduler().
     int noff;                // Depth of push_off() nesting.
     int intena;              // Were interrupts enabled before push_off()?
+    uint64 asidgen;          // ASID generation this hart's TLB belongs to.
+    struct mm* mm;           // Address space running here, or null; see asidswitch().
+    uint64 tlbreq;           // TLB shootdowns other harts asked for.
+    uint64 tlbdone;          // tlbreq when this hart last flushed for them.
+    int idle;                // In wfi in the scheduler, wants an IPI; see kick().
 };
 
 extern struct cpu cpus[NCPU];
@@ -97,6 +103,43 @@ struct trapframe {
     /* 280 */ uint64 t6;
 };
 
+// A region of user memory whose pages are filled in on first
+// touch, from an inode, from a shared memory object (shm.c),
+// or with zeros.  exec() creates one per loadable ELF segment,
+// mmap(), shmcreate() and shmattach() one per mapping.
+//! 进程只记录 "这段地址对应文件的哪一部分", 真正读盘推迟到缺页时
+struct vma {
+    uint64 start;      // first address, page-aligned
+    uint64 end;        // one past the last address; 0 if unused
+    int perm;          // PTE_R/W/X/U bits for the region's pages
+    int flags;         // MAP_SHARED or MAP_PRIVATE, maybe MAP_ANONYMOUS
+    struct inode* ip;  // file the pages come from (holds a reference), or 0
+    uint off;          // file offset of start
+    uint64 filesz;     // bytes backed by the file; the rest is zero
+    struct shm* shm;   // shared memory object (holds a reference), or 0
+};
+
+// A user address space.  fork() and exec() make a new one
+// for a process; the threads that clone() makes share their
+// creator's, so several harts may run it at once.
+//! 线程各有自己的 struct proc (内核栈, trapframe, 打开文件), 但共用这一个地址空间
+struct mm {
+    //! 线程同时缺页, sbrk, mmap 时修改的是同一个页表, 用它串行化
+    struct sleeplock lock;  // serializes changes by threads; see mmlock()
+    int ref;                // threads using it; changed with lock held
+    pagetable_t pagetable;  // User page table
+    uint64 sz;              // Size of process memory (bytes)
+
+    //! TLB 中本地址空间的项都带着这个 ASID, 切换页表时不必全部刷新
+    //! 高位是分配时的代 (generation), 低 16 位是 ASID 本身
+    uint64 asid;  // Generation and ASID of pagetable, see asidswitch()
+#define ASID(asid) ((asid)&SATP_ASIDMASK)
+    uint64 tlbmask;  // Harts whose TLB holds no stale entries of asid
+
+    //! 按需从文件读入的内存区域
+    struct vma vmas[NVMA];  // File-backed memory regions
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -114,6 +157,11 @@ struct proc {
     //! chan 是一个 tag, 用于唤醒时判断
     void* chan;  // If non-zero, sleeping on chan
 
+    // the sleep queue's lock must be held when using these:
+    //! 睡眠的进程挂在按 chan 散列的等待队列上, wakeup 只看这一个队列
+    struct sleepq* sq;     // Sleep queue it is on, or 0
+    struct proc* sqnext;  // Next on that queue
+
     //! killed 会用于 usertrap 在返回用户态前，如果 killed，直接 exit
     int killed;  // If non-zero, have been killed
 
@@ -123,24 +171,43 @@ struct proc {
     //! pid, 使用了 allocpid 的方式分配... 其实就是进程在数组中的下标
     int pid;  // Process ID
 
-    // wait_lock must be held when using this:
+    //! RUNNABLE 的进程挂在它上次运行的 hart 的运行队列上
+    struct proc* rqnext;  // Next on its run queue
+    int cpu;              // Hart it last ran on, or -1
+
+    //! MLFQ: level 是当前所在的队列, 用完时间片就往下降一级, 定期提升回 prio
+    int prio;   // Priority, 0..NPRIO-1; see setpriority()
+    int level;  // MLFQ level; prio at best
+    int ticks;  // Ticks used of this level's time slice
+    uint boost;  // Boost period level was last reset in
+
+    // tickslock must be held when using these:
+    //! sleep/nanosleep 的进程在 trap.c 的定时器堆里, 按 wakeat 排序
+    uint64 wakeat;  // Time CSR value it sleeps until
+    int timer;    // Index in the timer heap, or -1
+
+    // pid_lock must be held when using this:
+    struct proc* pidnext;  // Next in its pid hash chain
+
+    // wait_lock must be held when using these:
     //! 记录了 parent 的指针
     struct proc* parent;  // Parent process
+    //! 子进程串成单链表, wait 和 reparent 只看这些, 不用扫整个 proc[]
+    struct proc* children;  // First child
+    struct proc* sibling;   // Next child of parent
 
     // these are private to the process, so p->lock need not be held.
 
     //! 内核栈地址
     uint64 kstack;  // Virtual address of kernel stack
 
-    //! 这是用户空间堆的大小
-    uint64 sz;  // Size of process memory (bytes)
-
-    //! 页表, 只是一个长度为 512 的 uint64 数组，这是三级页表的大小
-    pagetable_t pagetable;  // User page table
+    //! 页表, 堆的大小和内存区域都在 mm 中, 同一进程的线程共用
+    //! 页表只是一个长度为 512 的 uint64 数组，这是三级页表的大小
+    struct mm* mm;  // User address space; 0 once exit() dropped it
 
     //! trapframe 指向用户态和内核态切换时的上下文信息
     //! 这里保存的是物理地址（即内核页表的地址）
-    //! 用户态下，trapframe 被放在 trampoline 后一个 page
+    //! 用户态下，proc[i] 的 trapframe 被放在 TRAPFRAME(i)
     struct trapframe* trapframe;  // data page for trampoline.S
 
     //! 经典上下文
@@ -154,6 +221,18 @@ struct proc {
     //! 每个进程都会记录一个当前工作区, chdir 将作用于它
     struct inode* cwd;  // Current directory
 
+    //! 缺页次数 (懒分配和 COW), 可以用 ^P 或 pgfaults() 查看
+    int pgfaults;  // Page faults handled for this process
+
+    //! 内核正通过物理地址读写的那一页用户内存, 不能被换出; 没有时是 MAXVA
+    uint64 pinva;  // User page pinned by upin(); see reclaim()
+
+    //! 本次系统调用 vmaprefault() 过的缓冲区, 返回前也不能被换出
+    uint64 pfstart, pfend;  // Buffer faulted in by vmaprefault(); see reclaim()
+
+    //! 持着睡眠锁时不能再去等 mm->lock, 否则可能和持着 mm->lock 读文件的线程死锁
+    int sleeplocks;  // Sleep-locks held; see mmlock()
+
     //! 呃没什么用的字段...
     char name[16];  // Process name (debugging)
 };
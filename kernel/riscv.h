@@ -186,7 +186,14 @@ static inline void w_pmpaddr0(uint64 x) {
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 
-#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+// satp bits 44..59 hold the address-space identifier (ASID):
+// TLB entries are tagged with it, so switching between page
+// tables with different ASIDs needs no flush.
+#define SATP_ASIDSHIFT 44
+#define SATP_ASIDMASK 0xFFFFL
+
+#define MAKE_SATP(pagetable, asid) \
+    (SATP_SV39 | (((uint64)(asid)) << SATP_ASIDSHIFT) | (((uint64)pagetable) >> 12))
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -229,6 +236,36 @@ static inline uint64 r_mcounteren() {
     return x;
 }
 
+#define MCOUNTEREN_TM (1L << 1)  // S mode may read the time CSR
+
+// Supervisor Counter-Enable
+static inline void w_scounteren(uint64 x) {
+    asm volatile("csrw scounteren, %0" : : "r"(x));
+}
+
+static inline uint64 r_scounteren() {
+    uint64 x;
+    asm volatile("csrr %0, scounteren" : "=r"(x));
+    return x;
+}
+
+#define SCOUNTEREN_TM (1L << 1)  // U mode may read the time CSR
+
+// Machine Environment Configuration Register; named by number
+// since older assemblers do not know it.  start.c probes for it.
+#define MENVCFG_CBZE (1L << 7)  // S and U modes may use cbo.zero
+#define MENVCFG_STCE (1L << 63)  // S mode has stimecmp (Sstc)
+
+static inline uint64 r_menvcfg() {
+    uint64 x;
+    asm volatile("csrr %0, 0x30a" : "=r"(x));
+    return x;
+}
+
+static inline void w_menvcfg(uint64 x) {
+    asm volatile("csrw 0x30a, %0" : : "r"(x));
+}
+
 // machine-mode cycle counter
 static inline uint64 r_time() {
     uint64 x;
@@ -236,6 +273,13 @@ static inline uint64 r_time() {
     return x;
 }
 
+// Supervisor Timer Compare (Sstc): a supervisor timer
+// interrupt is pending while time >= stimecmp.
+// 0x14d is stimecmp, which older assemblers do not know.
+static inline void w_stimecmp(uint64 x) {
+    asm volatile("csrw 0x14d, %0" : : "r"(x));
+}
+
 // enable device interrupts
 static inline void intr_on() {
     w_sstatus(r_sstatus() | SSTATUS_SIE);
@@ -252,6 +296,12 @@ static inline int intr_get() {
     return (x & SSTATUS_SIE) != 0;
 }
 
+// stall the hart until an interrupt is pending; also returns
+// when interrupts are disabled, without taking it.
+static inline void wfi() {
+    asm volatile("wfi");
+}
+
 static inline uint64 r_sp() {
     uint64 x;
     asm volatile("mv %0, sp" : "=r"(x));
@@ -282,6 +332,26 @@ static inline void sfence_vma() {
     asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void sfence_vma_asid(uint64 asid) {
+    asm volatile("sfence.vma zero, %0" : : "r"(asid) : "memory");
+}
+
+// flush the TLB entries of one page in one address space.
+static inline void sfence_vma_page(uint64 va, uint64 asid) {
+    asm volatile("sfence.vma %0, %1" : : "r"(va), "r"(asid) : "memory");
+}
+
+// bytes set to zero by one cbo.zero.  QEMU's default; the
+// device tree's riscv,cboz-block-size has the real value.
+#define CBOZSIZE 64
+
+// zero the cache block that contains a (Zicboz).
+// written with .insn so that older assemblers accept it.
+static inline void cbo_zero(void* a) {
+    asm volatile(".insn i 0x0f, 2, x0, %0, 4" : : "r"(a) : "memory");
+}
+
 typedef uint64 pte_t;
 typedef uint64* pagetable_t;  // 512 PTEs
 
@@ -293,11 +363,27 @@ typedef uint64* pagetable_t;  // 512 PTEs
 #define PGROUNDUP(sz) (((sz) + PGSIZE - 1) & ~(PGSIZE - 1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE - 1))
 
+// a level-1 leaf PTE maps a 2 MB megapage.
+#define MEGAPGSIZE (PGSIZE * 512)
+
+#define MEGAROUNDUP(sz) (((sz) + MEGAPGSIZE - 1) & ~(MEGAPGSIZE - 1))
+#define MEGAROUNDDOWN(a) (((a)) & ~(MEGAPGSIZE - 1))
+
 #define PTE_V (1L << 0)  // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4)  // user can access
+#define PTE_A (1L << 6)  // accessed, set by the hardware
+#define PTE_D (1L << 7)  // dirty, set by the hardware
+// the A and D bits a page fault handler sets when it maps a page
+// for an access (PTE_R, PTE_W or PTE_X): hardware that faults
+// on a clear A or D bit, instead of setting it, would fault again.
+#define PTE_AD(access) (PTE_A | ((access) == PTE_W ? PTE_D : 0))
+
+// bits 8 and 9 are reserved for software (RSW).
+#define PTE_COW (1L << 8)  // copy-on-write: writable once copied
+#define PTE_SWAP (1L << 9)  // not valid: the page is in swap.c's swap area
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -306,6 +392,10 @@ typedef uint64* pagetable_t;  // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte)&0x3FF)
 
+// a valid PTE with any of R/W/X set is a leaf; otherwise
+// it points to the next level of the page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R | PTE_W | PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK 0x1FF  // 9 bits
 #define PXSHIFT(level) (PGSHIFT + (9 * (level)))
@@ -0,0 +1,158 @@
+// Named shared memory objects.
+//
+// shmcreate() makes an object of zeroed pages with a name,
+// and shmattach() maps an existing object into another
+// process; both map it with a region (see vma.c) whose pages
+// vmaload() fills in from the object on first touch.  So
+// every process that attaches the object, and every child
+// forked from one, uses the same physical pages, and data
+// written by one is seen by the others without the kernel
+// copying it.  Each mapping of a page holds a reference to
+// it (kdup()), as does the object itself; an object goes
+// away, name and all, when its last region is unmapped by
+// shmdetach(), munmap(), exec() or exit().
+
+#include "defs.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "types.h"
+
+// most pages in an object: the page addresses fit in a page.
+#define SHMMAXPAGES (PGSIZE / sizeof(char*))
+
+struct shm {
+    char name[SHMNAME];
+    int ref;        // regions mapping the object; unused if 0
+    uint64 npages;  // size of the object in pages
+    char** pages;   // the pages, in a page from kalloc()
+};
+
+struct {
+    struct spinlock lock;
+    struct shm shms[NSHM];
+} shmtab;
+
+void shminit(void) {
+    initlock(&shmtab.lock, "shm");
+}
+
+// Find the object called name.  Caller must hold shmtab.lock.
+static struct shm* lookup(char* name) {
+    struct shm* s;
+
+    for (s = shmtab.shms; s < &shmtab.shms[NSHM]; s++) {
+        if (s->ref > 0 && strncmp(s->name, name, SHMNAME) == 0)
+            return s;
+    }
+    return 0;
+}
+
+// Free the pages of an object, or of one being made.
+static void freepages(char** pages, uint64 npages) {
+    for (uint64 i = 0; i < npages; i++)
+        if (pages[i])
+            kfree(pages[i]);
+    kfree(pages);
+}
+
+// Add a region's reference to s.
+void shmdup(struct shm* s) {
+    acquire(&shmtab.lock);
+    s->ref++;
+    release(&shmtab.lock);
+}
+
+// Drop a region's reference to s; the last one frees it.
+void shmput(struct shm* s) {
+    char** pages = 0;
+    uint64 npages = 0;
+
+    acquire(&shmtab.lock);
+    if (--s->ref == 0) {
+        pages = s->pages;
+        npages = s->npages;
+        s->pages = 0;
+        s->name[0] = 0;
+    }
+    release(&shmtab.lock);
+
+    //! 只是去掉对象自己的引用, 还映射着这些页的进程不受影响
+    if (pages)
+        freepages(pages, npages);
+}
+
+// The physical page at byte offset off in s.
+char* shmpage(struct shm* s, uint64 off) {
+    if (off / PGSIZE >= s->npages)
+        panic("shmpage");
+    return s->pages[off / PGSIZE];
+}
+
+// Create an object called name of size bytes, zeroed, and
+// map it into the current process.
+// Returns its address, or -1 if the name is taken, the size
+// is too big, or there is no memory.
+uint64 shmcreate(char* name, uint64 size) {
+    uint64 npages = PGROUNDUP(size) / PGSIZE, va;
+    struct shm* s;
+    char** pages;
+
+    if (name[0] == 0 || npages == 0 || npages > SHMMAXPAGES)
+        return -1;
+
+    //! 先在锁外把页都分配好
+    if ((pages = kzalloc()) == 0)
+        return -1;
+    for (uint64 i = 0; i < npages; i++) {
+        if ((pages[i] = kzalloc()) == 0) {
+            freepages(pages, npages);
+            return -1;
+        }
+    }
+
+    acquire(&shmtab.lock);
+    if (lookup(name) != 0) {
+        release(&shmtab.lock);
+        freepages(pages, npages);
+        return -1;
+    }
+    for (s = shmtab.shms; s < &shmtab.shms[NSHM]; s++) {
+        if (s->ref == 0)
+            break;
+    }
+    if (s == &shmtab.shms[NSHM]) {
+        release(&shmtab.lock);
+        freepages(pages, npages);
+        return -1;
+    }
+    safestrcpy(s->name, name, SHMNAME);
+    s->ref = 1;
+    s->npages = npages;
+    s->pages = pages;
+    release(&shmtab.lock);
+
+    //! vmashm() 失败时创建的引用由 shmput() 去掉, 对象也随之释放
+    if ((va = vmashm(s, npages * PGSIZE)) == -1)
+        shmput(s);
+    return va;
+}
+
+// Map the object called name into the current process.
+// Returns its address, or -1.
+uint64 shmattach(char* name) {
+    struct shm* s;
+    uint64 va;
+
+    acquire(&shmtab.lock);
+    if ((s = lookup(name)) == 0) {
+        release(&shmtab.lock);
+        return -1;
+    }
+    s->ref++;
+    release(&shmtab.lock);
+
+    if ((va = vmashm(s, s->npages * PGSIZE)) == -1)
+        shmput(s);
+    return va;
+}
@@ -0,0 +1,166 @@
+// Slab allocator for small, fixed-size kernel objects
+// (pipes, open files, in-memory inodes).
+//
+// Each kmem_cache carves 4096-byte pages from kalloc() into
+// objects of one size.  A slab page starts with a struct slab
+// header, followed by its objects; free objects in a slab are
+// linked through their first word.  Since a slab is exactly one
+// page, the slab an object belongs to is PGROUNDDOWN(object).
+//
+// In front of the slabs, every CPU has a magazine of free
+// objects, so the common alloc/free is a push or pop done with
+// interrupts off and no lock.  Magazines are refilled from, and
+// flushed to, the slabs MAGSIZE/2 objects at a time.
+
+#include "defs.h"
+#include "param.h"
+#include "riscv.h"
+#include "slab.h"
+#include "spinlock.h"
+#include "types.h"
+
+struct slab {
+    struct kmem_cache* cache;  // cache this slab belongs to
+    struct slab* next;         // in cache->partial
+    struct slab* prev;
+    void* free;  // free objects in this slab
+    int inuse;   // objects handed out, including those in magazines
+};
+
+#define SLABHDR ((sizeof(struct slab) + 7) & ~7L)
+
+void kmem_cache_init(struct kmem_cache* c, char* name, uint size) {
+    initlock(&c->lock, "kmem_cache");
+    c->name = name;
+    if (size < sizeof(void*))
+        size = sizeof(void*);
+    c->size = (size + 7) & ~7;
+    c->perslab = (PGSIZE - SLABHDR) / c->size;
+    if (c->perslab == 0)
+        panic("kmem_cache_init: object too big");
+    c->partial = 0;
+    c->nslab = 0;
+    for (int i = 0; i < NCPU; i++)
+        c->mag[i].n = 0;
+}
+
+static void partial_add(struct kmem_cache* c, struct slab* s) {
+    s->prev = 0;
+    s->next = c->partial;
+    if (c->partial)
+        c->partial->prev = s;
+    c->partial = s;
+}
+
+static void partial_remove(struct kmem_cache* c, struct slab* s) {
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        c->partial = s->next;
+    if (s->next)
+        s->next->prev = s->prev;
+}
+
+// get a fresh page from kalloc() and carve it into objects.
+// caller must hold c->lock.
+static struct slab* newslab(struct kmem_cache* c) {
+    struct slab* s;
+    char* obj;
+
+    if ((s = (struct slab*)kalloc()) == 0)
+        return 0;
+    s->cache = c;
+    s->inuse = 0;
+    s->free = 0;
+    for (int i = c->perslab - 1; i >= 0; i--) {
+        obj = (char*)s + SLABHDR + i * c->size;
+        *(void**)obj = s->free;
+        s->free = obj;
+    }
+    partial_add(c, s);
+    c->nslab++;
+    return s;
+}
+
+// return obj to its slab, giving the slab page back to
+// kalloc() if it is now unused and not the cache's only
+// partial slab.  caller must hold c->lock.
+static void putback(struct kmem_cache* c, void* obj) {
+    struct slab* s = (struct slab*)PGROUNDDOWN((uint64)obj);
+
+    if (s->cache != c)
+        panic("kmem_cache_free: wrong cache");
+
+    //! 原来是满的 slab, 重新挂回 partial 链表
+    if (s->free == 0)
+        partial_add(c, s);
+    *(void**)obj = s->free;
+    s->free = obj;
+    s->inuse--;
+
+    //! 留一个空 slab 备用，其余的直接还给 kalloc
+    if (s->inuse == 0 && (s->prev || s->next)) {
+        partial_remove(c, s);
+        c->nslab--;
+        kfree((void*)s);
+    }
+}
+
+// move up to MAGSIZE/2 objects from the slabs into m.
+static void refill(struct kmem_cache* c, struct magazine* m) {
+    struct slab* s;
+    void* obj;
+
+    acquire(&c->lock);
+    while (m->n < MAGSIZE / 2) {
+        if ((s = c->partial) == 0 && (s = newslab(c)) == 0)
+            break;
+        obj = s->free;
+        s->free = *(void**)obj;
+        s->inuse++;
+        if (s->free == 0)
+            partial_remove(c, s);
+        m->objs[m->n++] = obj;
+    }
+    release(&c->lock);
+}
+
+// move MAGSIZE/2 objects from m back to their slabs.
+static void flush(struct kmem_cache* c, struct magazine* m) {
+    acquire(&c->lock);
+    while (m->n > MAGSIZE / 2)
+        putback(c, m->objs[--m->n]);
+    release(&c->lock);
+}
+
+// Allocate one object from cache c.
+// The object is not initialized.
+// Returns 0 if the memory cannot be allocated.
+void* kmem_cache_alloc(struct kmem_cache* c) {
+    struct magazine* m;
+    void* obj = 0;
+
+    // the magazine belongs to this CPU; keep
+    // interrupts off so we stay on it.
+    push_off();
+    m = &c->mag[cpuid()];
+    if (m->n == 0)
+        refill(c, m);
+    if (m->n > 0)
+        obj = m->objs[--m->n];
+    pop_off();
+
+    return obj;
+}
+
+// Free an object that came from kmem_cache_alloc(c).
+void kmem_cache_free(struct kmem_cache* c, void* obj) {
+    struct magazine* m;
+
+    push_off();
+    m = &c->mag[cpuid()];
+    if (m->n == MAGSIZE)
+        flush(c, m);
+    m->objs[m->n++] = obj;
+    pop_off();
+}
@@ -0,0 +1,31 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "param.h"
+#include "spinlock.h"
+#include "types.h"
+
+// number of free objects each CPU can keep in its magazine.
+#define MAGSIZE 16
+
+// Per-CPU stash of free objects, so that most allocations
+// and frees touch neither the cache's lock nor its slabs.
+// Only used with interrupts off, by the CPU that owns it.
+struct magazine {
+    int n;                // Number of objects in objs[]
+    void* objs[MAGSIZE];  // Free objects, most recently freed last
+};
+
+// A cache of equally sized kernel objects, carved out of
+// whole pages ("slabs") obtained from kalloc().
+struct kmem_cache {
+    struct spinlock lock;   // protects partial and nslab
+    char* name;             // for debugging
+    uint size;              // object size, rounded up to 8 bytes
+    uint perslab;           // objects per slab page
+    struct slab* partial;   // slabs with at least one free object
+    int nslab;              // slab pages in use
+    struct magazine mag[NCPU];
+};
+
+#endif
@@ -26,6 +26,7 @@ void acquiresleep(struct sleeplock* lk) {
     }
     lk->locked = 1;
     lk->pid = myproc()->pid;
+    myproc()->sleeplocks++;
     release(&lk->lk);
 }
 
@@ -33,6 +34,7 @@ void releasesleep(struct sleeplock* lk) {
     acquire(&lk->lk);
     lk->locked = 0;
     lk->pid = 0;
+    myproc()->sleeplocks--;
     //! 将等待该锁的所有 SLEEPING 进程设置为 RUNNABLE
     wakeup(lk);
     release(&lk->lk);
@@ -75,6 +75,16 @@ int holding(struct spinlock* lk) {
     return r;
 }
 
+// Does the caller hold no spinlock, so that it may sleep?
+int cansleep(void) {
+    int ok;
+
+    push_off();
+    ok = mycpu()->noff == 1;
+    pop_off();
+    return ok;
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
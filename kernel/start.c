@@ -6,14 +6,25 @@
 
 void main();
 void timerinit();
+int probemenvcfg();
 
 // entry.S needs one stack per CPU.
 __attribute__((aligned(16))) char stack0[4096 * NCPU];
 
-// a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+// a scratch area per CPU for machine-mode timer interrupts
+// and IPIs.
+uint64 timer_scratch[NCPU][7];
 
-// assembly code in kernelvec.S for machine-mode timer interrupt.
+// set if the harts implement Zicboz, so the kernel
+// can zero pages with cbo.zero; see pagezero().
+int zicboz;
+
+// set if the harts implement Sstc, so the kernel programs
+// its own timer interrupts with stimecmp; see timerset().
+int sstc;
+
+// assembly code in kernelvec.S for machine-mode timer and
+// software interrupts.
 extern void timervec();
 
 // entry.S jumps here in machine mode on stack0.
@@ -51,6 +62,33 @@ void start() {
     w_pmpaddr0(0x3fffffffffffffull);
     w_pmpcfg0(0xf);
 
+    // menvcfg only exists from privileged spec 1.12 on; an
+    // older hart traps on any access to it, so probe first.
+    int envcfg = probemenvcfg();
+
+    // let supervisor mode use cbo.zero, if the hart has it.
+    // otherwise pagezero() zeroes a word at a time.
+    //! CBZE 是 WARL 字段, 没有 Zicboz 的 hart 上写不进去, 读回来是 0
+    if (envcfg) {
+        w_menvcfg(r_menvcfg() | MENVCFG_CBZE);
+        if (r_menvcfg() & MENVCFG_CBZE)
+            zicboz = 1;
+    }
+
+    // let supervisor and user mode read the time CSR, and
+    // program timer interrupts with stimecmp if the hart has
+    // Sstc.  user code reads the time itself; see vdso.h.
+    // without menvcfg there is no Sstc either, and the clock
+    // stays on the CLINT's mtimecmp and timervec.
+    //! STCE 也是 WARL 字段, 没有 Sstc 时读回来是 0, 只能用 M 模式的 timervec
+    w_mcounteren(r_mcounteren() | MCOUNTEREN_TM);
+    w_scounteren(r_scounteren() | SCOUNTEREN_TM);
+    if (envcfg) {
+        w_menvcfg(r_menvcfg() | MENVCFG_STCE);
+        if (r_menvcfg() & MENVCFG_STCE)
+            sstc = 1;
+    }
+
     // ask for clock interrupts.
     //! 初始化时钟中断
     timerinit();
@@ -65,26 +103,37 @@ void start() {
     asm volatile("mret");
 }
 
-// arrange to receive timer interrupts.
+// arrange to receive timer interrupts, and IPIs sent
+// by other harts through the CLINT (see ipi() in trap.c).
 // they will arrive in machine mode at
 // at timervec in kernelvec.S,
 // which turns them into software interrupts for
 // devintr() in trap.c.
+// with Sstc, timer interrupts go to supervisor mode
+// directly instead, when timerset() in trap.c asks.
 void timerinit() {
     // each CPU has a separate source of timer interrupts.
     int id = r_mhartid();
 
-    // ask the CLINT for a timer interrupt.
-    int interval = 1000000;  // cycles; about 1/10th second in qemu.
-    *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+    // ask the CLINT for a timer interrupt, or, with Sstc,
+    // for none until the kernel programs stimecmp.
+    int interval = TICKCYCLES;
+    if (sstc)
+        w_stimecmp(~0ULL);
+    else
+        *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
 
     // prepare information in scratch[] for timervec.
     // scratch[0..2] : space for timervec to save registers.
     // scratch[3] : address of CLINT MTIMECMP register.
     // scratch[4] : desired interval (in cycles) between timer interrupts.
+    // scratch[5] : address of CLINT MSIP register.
+    // scratch[6] : set by timervec on a timer interrupt, for devintr().
     uint64* scratch = &timer_scratch[id][0];
     scratch[3] = CLINT_MTIMECMP(id);
     scratch[4] = interval;
+    scratch[5] = CLINT_MSIP(id);
+    scratch[6] = 0;
     w_mscratch((uint64)scratch);
 
     // set the machine-mode trap handler.
@@ -93,6 +142,7 @@ void timerinit() {
     // enable machine-mode interrupts.
     w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-    // enable machine-mode timer interrupts.
-    w_mie(r_mie() | MIE_MTIE);
+    // enable machine-mode software interrupts, and timer
+    // interrupts unless supervisor mode has its own.
+    w_mie(r_mie() | MIE_MSIE | (sstc ? 0 : MIE_MTIE));
 }
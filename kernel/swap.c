@@ -0,0 +1,289 @@
+// Swapping user pages out to the disk.
+//
+// When kalloc() runs out of pages for user memory, ualloc()
+// calls reclaim(), which writes some user pages to a swap
+// area on the disk and frees them.  The swap area is
+// NSWAPPAGES page-sized slots that follow the file system,
+// starting at block FSSIZE.  The PTE of a page that was
+// swapped out has PTE_V clear and PTE_SWAP set, keeps the
+// page's permission bits, and holds the slot number where
+// the physical page number would be.  Touching the page
+// faults, and vmfault() calls swapin() to read it back.
+//
+// reclaim() picks victims with the clock (second chance)
+// algorithm: it sweeps over the processes' pages, clearing
+// the accessed bit (PTE_A) of pages that were used since the
+// last sweep, and evicting those that were not.  Only pages
+// that belong to one process alone are evicted: not shared
+// copy-on-write and not in a mmap() region; megapages are
+// split first.  Processes that sleep or wait to run lose
+// pages too, even in the middle of a system call, except the
+// page the kernel is copying to or from (see upin()) and the
+// buffer the call faulted in up front (see vmaprefault()),
+// which may later be copied with a spinlock held.
+// Address spaces shared by threads (see clone()) are
+// left alone, since another thread may be using them, and
+// so is one whose process was preempted or went to sleep
+// while changing its page table under mmlock().
+
+#include "buf.h"
+#include "defs.h"
+#include "fs.h"
+#include "memlayout.h"
+#include "memstat.h"
+#include "param.h"
+#include "proc.h"
+#include "riscv.h"
+#include "sleeplock.h"
+#include "spinlock.h"
+#include "types.h"
+
+// disk blocks per slot.
+#define SLOTBLOCKS (PGSIZE / BSIZE)
+
+// most pages written out by one reclaim().
+#define SWAPBATCH 16
+
+//! 换出页的 PTE: V 位为 0, PTE_SWAP 为 1, 原来放物理页号的位置放槽号
+#define SLOT2PTE(s) (((uint64)(s)) << 10)
+#define PTE2SLOT(pte) ((pte) >> 10)
+
+extern struct proc proc[NPROC];
+
+struct {
+    //! 保护 ref[], nused 和计数器
+    struct spinlock lock;
+
+    //! 每个槽被多少个 PTE 引用, fork 时子进程和父进程共用同一个槽
+    uchar ref[NSWAPPAGES];
+    int nused;
+    uint64 swapins;
+    uint64 swapouts;
+
+    //! 同一时间只有一个换入或者换出, reclaim() 从头到尾都持有它
+    //! 换出的页在写完之前, 换入它的进程会在这里等待
+    struct sleeplock io;
+
+    //! 给 virtio_disk_rw() 用的缓冲区, 不经过 buffer cache
+    struct buf buf;
+
+    //! 时钟指针: 下一个要看的进程和其中的地址, 由 io 保护
+    int hand;
+    uint64 handva;
+} swap;
+
+void swapinit(void) {
+    initlock(&swap.lock, "swap");
+    initsleeplock(&swap.io, "swapio");
+}
+
+// Allocate a slot, with one reference.
+// Returns the slot, or -1 if the swap area is full.
+static int slotalloc(void) {
+    int s;
+
+    acquire(&swap.lock);
+    for (s = 0; s < NSWAPPAGES; s++) {
+        if (swap.ref[s] == 0) {
+            swap.ref[s] = 1;
+            swap.nused++;
+            release(&swap.lock);
+            return s;
+        }
+    }
+    release(&swap.lock);
+    return -1;
+}
+
+// Add a reference to the slot of a swapped-out PTE, for a
+// copy of the PTE made by fork().
+void swapdup(pte_t pte) {
+    acquire(&swap.lock);
+    swap.ref[PTE2SLOT(pte)]++;
+    release(&swap.lock);
+}
+
+// Drop the reference of a swapped-out PTE to its slot.
+void swapfree(pte_t pte) {
+    uint64 s = PTE2SLOT(pte);
+
+    acquire(&swap.lock);
+    if (s >= NSWAPPAGES || swap.ref[s] == 0)
+        panic("swapfree");
+    if (--swap.ref[s] == 0)
+        swap.nused--;
+    release(&swap.lock);
+}
+
+// Read or write the page at pa from or to a slot.
+// Caller must hold swap.io.
+static void swapio(int slot, char* pa, int write) {
+    for (int i = 0; i < SLOTBLOCKS; i++) {
+        swap.buf.blockno = FSSIZE + slot * SLOTBLOCKS + i;
+        if (write)
+            memmove(swap.buf.data, pa + i * BSIZE, BSIZE);
+        virtio_disk_rw(&swap.buf, write);
+        if (!write)
+            memmove(pa + i * BSIZE, swap.buf.data, BSIZE);
+    }
+}
+
+// Move the clock hand over the pages of p's address space from swap.handva up,
+// giving accessed pages a second chance and turning the PTEs
+// of the others into swap PTEs, until max pages are taken or
+// the end of p's memory is reached (swap.handva is then 0).
+// The physical pages and their slots go in pas[] and slots[];
+// the caller writes them out.  Returns the number of pages.
+// p must be the current process, or the caller must hold
+// p->lock.  Caller must hold swap.io.
+static int scan(struct proc* p, uint64* pas, int* slots, int max) {
+    struct mm* mm = p->mm;
+    uint64 a = swap.handva, pa;
+    int n = 0, s, cleared = 0;
+    pte_t* pte;
+
+    while (a < mm->sz && n < max) {
+        //! 没有页表的 2 MB 整个跳过; 超级页先拆开, 拆不了也跳过
+        pte = walklevel(mm->pagetable, a, 1, 0);
+        if (pte == 0 || (*pte & PTE_V) == 0 || (PTE_LEAF(*pte) && uvmsplit(mm->pagetable, a) < 0)) {
+            a = MEGAROUNDDOWN(a) + MEGAPGSIZE;
+            continue;
+        }
+        pte = walk(mm->pagetable, a, 0);
+        a += PGSIZE;
+        if ((*pte & (PTE_V | PTE_U)) != (PTE_V | PTE_U) || (*pte & PTE_COW))
+            continue;
+        //! 内核正通过物理地址读写这一页, 可能中途睡眠或被抢占
+        if (a - PGSIZE == p->pinva || (a > p->pfstart && a <= p->pfend))
+            continue;
+        pa = PTE2PA(*pte);
+        if (krefcnt((void*)pa) != 1)
+            continue;
+
+        //! 最近访问过, 再给一次机会
+        if (*pte & PTE_A) {
+            *pte &= ~PTE_A;
+            cleared = 1;
+            continue;
+        }
+
+        if ((s = slotalloc()) < 0)
+            break;
+        *pte = SLOT2PTE(s) | (PTE_FLAGS(*pte) & ~(PTE_V | PTE_A | PTE_D)) | PTE_SWAP;
+        pas[n] = pa;
+        slots[n] = s;
+        n++;
+    }
+    swap.handva = a < mm->sz ? a : 0;
+
+    //! TLB 里可能还有这些页的旧项; 别的进程下次运行时整个 ASID 刷新
+    if (p == myproc()) {
+        if (n > 0 || cleared)
+            uvmflush(mm->pagetable, 0, 2);
+    } else {
+        mm->tlbmask = 0;
+    }
+    return n;
+}
+
+// Write up to SWAPBATCH user pages out to the swap area and
+// free them.  Returns the number of pages freed.
+static int reclaim(void) {
+    struct proc *me = myproc(), *p;
+    uint64 pas[SWAPBATCH];
+    int slots[SWAPBATCH];
+    int n = 0, visits;
+
+    acquiresleep(&swap.io);
+
+    //! 最多转两圈: 第一圈清掉的 A 位, 第二圈就能换出了
+    for (visits = 0; visits <= 2 * NPROC && n < SWAPBATCH; visits++) {
+        p = &proc[swap.hand];
+        if (p != me)
+            acquire(&p->lock);
+        //! 多个线程共用的地址空间不换出; 进程正在改自己的页表 (持有 mm->lock) 时也不动
+        if (p->mm == 0 || p->mm->ref != 1 || (p != me && p->mm->lock.locked))
+            swap.handva = 0;
+        else if (p == me || p->state == RUNNABLE || p->state == SLEEPING)
+            n += scan(p, pas + n, slots + n, SWAPBATCH - n);
+        else
+            swap.handva = 0;
+        if (p != me)
+            release(&p->lock);
+        if (swap.handva == 0)
+            swap.hand = (swap.hand + 1) % NPROC;
+    }
+
+    //! 写盘时不持有 p->lock; 进程这时碰到这些页会在 swap.io 上等着
+    for (int i = 0; i < n; i++) {
+        swapio(slots[i], (char*)pas[i], 1);
+        kfree((void*)pas[i]);
+    }
+
+    acquire(&swap.lock);
+    swap.swapouts += n;
+    release(&swap.lock);
+
+    releasesleep(&swap.io);
+    return n;
+}
+
+// Allocate a page for user memory, zeroed if zero is set,
+// swapping other user pages out to make room if memory
+// has run out.  Only swaps when the caller holds no spinlock.
+// Returns 0 if no page can be found.
+void* ualloc(int zero) {
+    void* pa;
+
+    for (;;) {
+        if ((pa = zero ? kzalloc() : kalloc()) != 0)
+            return pa;
+        if (!cansleep() || reclaim() == 0)
+            return 0;
+    }
+}
+
+// Read the swapped-out page at va of the current process,
+// whose page table is pagetable, back in, for an access
+// (PTE_R, PTE_W or PTE_X).
+// Returns 0 on success, -1 if there is no memory or the
+// caller holds a spinlock and cannot wait for the disk.
+int swapin(pagetable_t pagetable, uint64 va, int access) {
+    pte_t* pte;
+    pte_t old;
+    char* mem;
+
+    if (!cansleep() || (mem = ualloc(0)) == 0)
+        return -1;
+
+    acquiresleep(&swap.io);
+    //! 睡眠过, 重新检查一遍 PTE
+    pte = walk(pagetable, va, 0);
+    if (pte == 0 || (*pte & PTE_SWAP) == 0) {
+        releasesleep(&swap.io);
+        kfree(mem);
+        return 0;
+    }
+    old = *pte;
+    swapio(PTE2SLOT(old), mem, 0);
+    *pte = PA2PTE(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_AD(access) | PTE_V;
+    swapfree(old);
+
+    acquire(&swap.lock);
+    swap.swapins++;
+    release(&swap.lock);
+
+    releasesleep(&swap.io);
+    uvmflush(pagetable, va, 1);
+    return 0;
+}
+
+// Fill in the swap part of a struct memstat.
+void swapstat(struct memstat* st) {
+    acquire(&swap.lock);
+    st->swapins = swap.swapins;
+    st->swapouts = swap.swapouts;
+    st->swapused = swap.nused;
+    st->swapfree = NSWAPPAGES - swap.nused;
+    release(&swap.lock);
+}
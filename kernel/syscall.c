@@ -10,9 +10,9 @@
 // Fetch the uint64 at addr from the current process.
 int fetchaddr(uint64 addr, uint64* ip) {
     struct proc* p = myproc();
-    if (addr >= p->sz || addr + sizeof(uint64) > p->sz)  // both tests needed, in case of overflow
+    if (addr >= p->mm->sz || addr + sizeof(uint64) > p->mm->sz)  // both tests needed, in case of overflow
         return -1;
-    if (copyin(p->pagetable, (char*)ip, addr, sizeof(*ip)) != 0)
+    if (copyin(p->mm->pagetable, (char*)ip, addr, sizeof(*ip)) != 0)
         return -1;
     return 0;
 }
@@ -21,7 +21,7 @@ int fetchaddr(uint64 addr, uint64* ip) {
 // Returns length of string, not including nul, or -1 for error.
 int fetchstr(uint64 addr, char* buf, int max) {
     struct proc* p = myproc();
-    if (copyinstr(p->pagetable, buf, addr, max) < 0)
+    if (copyinstr(p->mm->pagetable, buf, addr, max) < 0)
         return -1;
     return strlen(buf);
 }
@@ -89,6 +89,20 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_memstat(void);
+extern uint64 sys_pgfaults(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_shmcreate(void);
+extern uint64 sys_shmattach(void);
+extern uint64 sys_shmdetach(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_futex(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_getpriority(void);
+extern uint64 sys_clock_gettime(void);
+extern uint64 sys_nanosleep(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -98,7 +112,12 @@ static uint64 (*syscalls[])(void) = {
     [SYS_chdir] = sys_chdir, [SYS_dup] = sys_dup,       [SYS_getpid] = sys_getpid, [SYS_sbrk] = sys_sbrk,
     [SYS_sleep] = sys_sleep, [SYS_uptime] = sys_uptime, [SYS_open] = sys_open,     [SYS_write] = sys_write,
     [SYS_mknod] = sys_mknod, [SYS_unlink] = sys_unlink, [SYS_link] = sys_link,     [SYS_mkdir] = sys_mkdir,
-    [SYS_close] = sys_close,
+    [SYS_close] = sys_close, [SYS_memstat] = sys_memstat,
+    [SYS_pgfaults] = sys_pgfaults, [SYS_mmap] = sys_mmap, [SYS_munmap] = sys_munmap,
+    [SYS_spawn] = sys_spawn, [SYS_shmcreate] = sys_shmcreate, [SYS_shmattach] = sys_shmattach,
+    [SYS_shmdetach] = sys_shmdetach, [SYS_clone] = sys_clone, [SYS_futex] = sys_futex,
+    [SYS_setpriority] = sys_setpriority, [SYS_getpriority] = sys_getpriority,
+    [SYS_clock_gettime] = sys_clock_gettime, [SYS_nanosleep] = sys_nanosleep,
 };
 
 void syscall(void) {
@@ -114,6 +133,8 @@ void syscall(void) {
 
         //! 直接执行，并修改返回值
         p->trapframe->a0 = syscalls[num]();
+        //! vmaprefault() 钉住的缓冲区到此可以换出了
+        p->pfstart = p->pfend = 0;
 
     } else {
         printf("%d %s: unknown sys call %d\n", p->pid, p->name, num);
@@ -23,5 +23,19 @@
 #define SYS_link 19
 #define SYS_mkdir 20
 #define SYS_close 21
+#define SYS_memstat 22
+#define SYS_pgfaults 23
+#define SYS_mmap 24
+#define SYS_munmap 25
+#define SYS_spawn 26
+#define SYS_shmcreate 27
+#define SYS_shmattach 28
+#define SYS_shmdetach 29
+#define SYS_clone 30
+#define SYS_futex 31
+#define SYS_setpriority 32
+#define SYS_getpriority 33
+#define SYS_clock_gettime 34
+#define SYS_nanosleep 35
 
 #endif  // __SYSCALL_H__
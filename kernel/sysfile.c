@@ -68,6 +68,8 @@ uint64 sys_read(void) {
     argint(2, &n);
     if (argfd(0, 0, &f) < 0)
         return -1;
+    //! 拷贝时会持有锁, 不能再去读盘或者等地址空间的锁, 所以先把缓冲区的页都弄好
+    vmaprefault(p, n, 1);
     return fileread(f, p, n);
 }
 
@@ -80,6 +82,7 @@ uint64 sys_write(void) {
     argint(2, &n);
     if (argfd(0, 0, &f) < 0)
         return -1;
+    vmaprefault(p, n, 0);
 
     return filewrite(f, p, n);
 }
@@ -406,22 +409,20 @@ uint64 sys_chdir(void) {
 //!   xv6 的中断处理程序通过 trapframe 维护用户态的上下文
 //!   因此, 在 exec 中修改 trapframe 的部分会在回到中断处理后起作用
 //!   跳转回用户态时，会将 epc 恢复回 pc 中，从而开始执行入口函数
-uint64 sys_exec(void) {
-    char path[MAXPATH], *argv[MAXARG];
+// Copy the user argument vector at uargv into argv, in pages
+// from kalloc() that the caller frees with freeargv().
+// Returns 0 on success, -1 on failure.
+static int fetchargv(uint64 uargv, char** argv) {
+    uint64 uarg;
     int i;
-    uint64 uargv, uarg;
 
-    argaddr(1, &uargv);
-    if (argstr(0, path, MAXPATH) < 0) {
-        return -1;
-    }
-    memset(argv, 0, sizeof(argv));
+    memset(argv, 0, MAXARG * sizeof(char*));
     for (i = 0;; i++) {
-        if (i >= NELEM(argv)) {
-            goto bad;
+        if (i >= MAXARG) {
+            return -1;
         }
         if (fetchaddr(uargv + sizeof(uint64) * i, (uint64*)&uarg) < 0) {
-            goto bad;
+            return -1;
         }
         if (uarg == 0) {
             argv[i] = 0;
@@ -429,22 +430,67 @@ uint64 sys_exec(void) {
         }
         argv[i] = kalloc();
         if (argv[i] == 0)
-            goto bad;
+            return -1;
         if (fetchstr(uarg, argv[i], PGSIZE) < 0)
-            goto bad;
+            return -1;
     }
+    return 0;
+}
 
-    int ret = exec(path, argv);
-
-    for (i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+static void freeargv(char** argv) {
+    for (int i = 0; i < MAXARG && argv[i] != 0; i++)
         kfree(argv[i]);
+}
+
+uint64 sys_exec(void) {
+    char path[MAXPATH], *argv[MAXARG];
+    uint64 uargv;
+    int ret;
 
+    argaddr(1, &uargv);
+    if (argstr(0, path, MAXPATH) < 0) {
+        return -1;
+    }
+    if (fetchargv(uargv, argv) < 0) {
+        freeargv(argv);
+        return -1;
+    }
+
+    ret = exec(path, argv);
+
+    freeargv(argv);
     return ret;
+}
 
-bad:
-    for (i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-        kfree(argv[i]);
-    return -1;
+// spawn(path, argv, acts): start path in a new process;
+// acts is a list of file actions ending with op 0, or null.
+uint64 sys_spawn(void) {
+    char path[MAXPATH], *argv[MAXARG];
+    struct spawnact acts[2 * NOFILE];
+    uint64 uargv, uacts;
+    int nact = 0, ret;
+
+    argaddr(1, &uargv);
+    argaddr(2, &uacts);
+    if (argstr(0, path, MAXPATH) < 0)
+        return -1;
+    for (; uacts != 0; nact++) {
+        if (nact == NELEM(acts))
+            return -1;
+        if (copyin(myproc()->mm->pagetable, (char*)&acts[nact], uacts + nact * sizeof(acts[0]), sizeof(acts[0])) < 0)
+            return -1;
+        if (acts[nact].op == 0)
+            break;
+    }
+    if (fetchargv(uargv, argv) < 0) {
+        freeargv(argv);
+        return -1;
+    }
+
+    ret = spawn(path, argv, acts, nact);
+
+    freeargv(argv);
+    return ret;
 }
 
 uint64 sys_pipe(void) {
@@ -464,8 +510,8 @@ uint64 sys_pipe(void) {
         fileclose(wf);
         return -1;
     }
-    if (copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
-        copyout(p->pagetable, fdarray + sizeof(fd0), (char*)&fd1, sizeof(fd1)) < 0) {
+    if (copyout(p->mm->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
+        copyout(p->mm->pagetable, fdarray + sizeof(fd0), (char*)&fd1, sizeof(fd1)) < 0) {
         p->ofile[fd0] = 0;
         p->ofile[fd1] = 0;
         fileclose(rf);
@@ -474,3 +520,31 @@ uint64 sys_pipe(void) {
     }
     return 0;
 }
+
+// map a file, or anonymous memory, into the address space.
+// the address argument is only a hint and is ignored.
+uint64 sys_mmap(void) {
+    uint64 len;
+    int prot, flags, off;
+    struct file* f = 0;
+
+    argaddr(1, &len);
+    argint(2, &prot);
+    argint(3, &flags);
+    argint(5, &off);
+    if ((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+        return -1;
+    if (off < 0)
+        return -1;
+    return vmammap(len, prot, flags, f, off);
+}
+
+uint64 sys_munmap(void) {
+    uint64 addr, len;
+
+    argaddr(0, &addr);
+    argaddr(1, &len);
+    if (addr % PGSIZE != 0 || len == 0)
+        return -1;
+    return vmaunmap(myproc()->mm, addr, len);
+}
@@ -1,9 +1,12 @@
 #include "defs.h"
+#include "fcntl.h"
 #include "memlayout.h"
+#include "memstat.h"
 #include "param.h"
 #include "proc.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "time.h"
 #include "types.h"
 
 uint64 sys_exit(void) {
@@ -24,36 +27,30 @@ uint64 sys_fork(void) {
 uint64 sys_wait(void) {
     uint64 p;
     argaddr(0, &p);
+    if (p != 0)
+        vmaprefault(p, sizeof(int), 1);
     return wait(p);
 }
 
 uint64 sys_sbrk(void) {
-    uint64 addr;
     int n;
 
     argint(0, &n);
-    addr = myproc()->sz;
-    if (growproc(n) < 0)
-        return -1;
-    return addr;
+    return growproc(n);
 }
 
 uint64 sys_sleep(void) {
-    int n;
-    uint ticks0;
+    int n, r;
 
     argint(0, &n);
+    if (n < 0)
+        n = 0;
     acquire(&tickslock);
-    ticks0 = ticks;
-    while (ticks - ticks0 < n) {
-        if (killed(myproc())) {
-            release(&tickslock);
-            return -1;
-        }
-        sleep(&ticks, &tickslock);
-    }
+    tickupdate();
+    //! 没有周期性的时钟了, 进定时器堆等 ticks 到 ticks + n
+    r = timesleep((uint64)(ticks + n) * TICKCYCLES);
     release(&tickslock);
-    return 0;
+    return r;
 }
 
 uint64 sys_kill(void) {
@@ -63,13 +60,162 @@ uint64 sys_kill(void) {
     return kill(pid);
 }
 
+// setpriority(pid, prio): set the scheduling priority of pid,
+// 0 (the highest) to NPRIO-1.
+uint64 sys_setpriority(void) {
+    int pid, prio;
+
+    argint(0, &pid);
+    argint(1, &prio);
+    return setpriority(pid, prio);
+}
+
+uint64 sys_getpriority(void) {
+    int pid;
+
+    argint(0, &pid);
+    return getpriority(pid);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64 sys_uptime(void) {
     uint xticks;
 
     acquire(&tickslock);
+    tickupdate();
     xticks = ticks;
     release(&tickslock);
     return xticks;
 }
+
+// clock_gettime(clock, ts): the time since boot, to the
+// resolution of the time CSR rather than of ticks.
+uint64 sys_clock_gettime(void) {
+    int clock;
+    uint64 addr, t;
+    struct timespec ts;
+
+    argint(0, &clock);
+    argaddr(1, &addr);
+    if (clock != CLOCK_MONOTONIC)
+        return -1;
+    t = r_time();
+    ts.tv_sec = t / TIMEFREQ;
+    ts.tv_nsec = (t % TIMEFREQ) * (NSEC_PER_SEC / TIMEFREQ);
+    if (copyout(myproc()->mm->pagetable, addr, (char*)&ts, sizeof(ts)) < 0)
+        return -1;
+    return 0;
+}
+
+// nanosleep(ts): sleep for the span in *ts, rounded up to
+// the next cycle of the time CSR.
+uint64 sys_nanosleep(void) {
+    uint64 addr, t;
+    struct timespec ts;
+    int r;
+
+    argaddr(0, &addr);
+    if (copyin(myproc()->mm->pagetable, (char*)&ts, addr, sizeof(ts)) < 0)
+        return -1;
+    if (ts.tv_nsec >= NSEC_PER_SEC)
+        return -1;
+    //! 防止乘法溢出; 这么久的睡眠和永远睡下去没有区别
+    if (ts.tv_sec > ~0ULL / TIMEFREQ / 2)
+        ts.tv_sec = ~0ULL / TIMEFREQ / 2;
+    t = r_time() + ts.tv_sec * TIMEFREQ +
+        (ts.tv_nsec + NSEC_PER_SEC / TIMEFREQ - 1) / (NSEC_PER_SEC / TIMEFREQ);
+    acquire(&tickslock);
+    r = timesleep(t);
+    release(&tickslock);
+    return r;
+}
+
+// report free physical memory and how fragmented it is.
+uint64 sys_memstat(void) {
+    uint64 addr;
+    struct memstat st;
+
+    argaddr(0, &addr);
+    kmemstat(&st);
+    swapstat(&st);
+    if (copyout(myproc()->mm->pagetable, addr, (char*)&st, sizeof(st)) < 0)
+        return -1;
+    return 0;
+}
+
+// return how many page faults the kernel has
+// handled for this process so far.
+uint64 sys_pgfaults(void) {
+    return myproc()->pgfaults;
+}
+
+// shmcreate(name, size): create a shared memory object
+// and map it; returns its address.
+uint64 sys_shmcreate(void) {
+    char name[SHMNAME];
+    uint64 size;
+
+    if (argstr(0, name, SHMNAME) < 0)
+        return -1;
+    argaddr(1, &size);
+    return shmcreate(name, size);
+}
+
+// shmattach(name): map an existing shared memory object;
+// returns its address.
+uint64 sys_shmattach(void) {
+    char name[SHMNAME];
+
+    if (argstr(0, name, SHMNAME) < 0)
+        return -1;
+    return shmattach(name);
+}
+
+// shmdetach(addr): unmap the shared memory object mapped
+// at addr.
+uint64 sys_shmdetach(void) {
+    struct mm* mm = myproc()->mm;
+    uint64 addr, start, end;
+    struct vma* v;
+
+    argaddr(0, &addr);
+    if (mmlock(mm) < 0)
+        return -1;
+    if ((v = vmalookup(mm, addr)) == 0 || v->shm == 0) {
+        mmunlock(mm);
+        return -1;
+    }
+    start = v->start;
+    end = v->end;
+    mmunlock(mm);
+    return vmaunmap(mm, start, end - start);
+}
+
+// clone(fn, arg, stack): start a thread that shares this
+// address space, running fn(arg) on stack; returns its pid.
+uint64 sys_clone(void) {
+    uint64 fn, arg, stack;
+
+    argaddr(0, &fn);
+    argaddr(1, &arg);
+    argaddr(2, &stack);
+    return clone(fn, arg, stack);
+}
+
+// futex(addr, op, val): FUTEX_WAIT sleeps while the int at
+// addr is val, FUTEX_WAKE wakes up to val threads waiting
+// on addr and returns how many it woke.
+uint64 sys_futex(void) {
+    uint64 addr;
+    int op, val;
+
+    argaddr(0, &addr);
+    argint(1, &op);
+    argint(2, &val);
+    if (op == FUTEX_WAIT)
+        return futexwait(addr, val);
+    if (op == FUTEX_WAKE)
+        return futexwake(addr, val);
+    return -1;
+}
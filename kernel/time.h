@@ -0,0 +1,18 @@
+#ifndef TIME_H
+#define TIME_H
+
+#include "types.h"
+
+// clocks for clock_gettime().
+#define CLOCK_MONOTONIC 1  // Time since boot, from the time CSR
+
+#define NSEC_PER_SEC 1000000000L
+
+// A time, or a span of time, for clock_gettime() and
+// nanosleep().
+struct timespec {
+    uint64 tv_sec;   // Seconds
+    uint64 tv_nsec;  // Nanoseconds, less than NSEC_PER_SEC
+};
+
+#endif
@@ -7,10 +7,27 @@
 #include "types.h"
 
 struct spinlock tickslock;
-uint ticks;
+uint ticks;  // time CSR / TICKCYCLES, as of the last tickupdate()
+
+// the sleepers in sys_sleep() and sys_nanosleep(), in a binary
+// min-heap ordered by the time CSR value each waits for
+// (p->wakeat); p->timer is p's index in it.  wakeat is the
+// earliest such time, or NOWAKE.  protected by tickslock.
+#define NOWAKE (~0ULL)
+static struct proc* timers[NPROC];
+static int ntimers;
+static uint64 wakeat = NOWAKE;
+
+// in start.c; set if the harts have stimecmp.
+extern int sstc;
 
 extern char trampoline[], uservec[], userret[];
 
+extern struct proc proc[NPROC];
+
+// in start.c; timervec sets timer_scratch[hart][6] on a tick.
+extern uint64 timer_scratch[NCPU][7];
+
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
 
@@ -23,6 +40,7 @@ void trapinit(void) {
 // set up to take exceptions and traps while in the kernel.
 void trapinithart(void) {
     w_stvec((uint64)kernelvec);
+    timerset();
 }
 
 //
@@ -69,6 +87,11 @@ void usertrap(void) {
         //! 外设中断处理
     } else if ((which_dev = devintr()) != 0) {
         // ok
+    } else if ((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+               vmfault(p->mm->pagetable, r_stval(),
+                       r_scause() == 15 ? PTE_W : (r_scause() == 12 ? PTE_X : PTE_R)) == 0) {
+        // page fault on a lazily allocated heap page or a
+        // copy-on-write page; it is mapped now, retry.
     } else {
         printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
         printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -78,9 +101,10 @@ void usertrap(void) {
     if (killed(p))
         exit(-1);
 
-    // give up the CPU if this is a timer interrupt.
+    // give up the CPU if this is a timer interrupt and the
+    // scheduler says so.
     if (which_dev == 2)
-        yield();
+        preempt();
 
     usertrapret();
 }
@@ -111,6 +135,11 @@ void usertrapret(void) {
     p->trapframe->kernel_trap = (uint64)usertrap;
     p->trapframe->kernel_hartid = r_tp();  // hartid for cpuid()
 
+    // hand user code its proc slot in tp, with which it
+    // finds its pid in the vdso page; see vdso.h.
+    //! 用户程序没有 TLS, tp 空着, 借来存 p - proc
+    p->trapframe->tp = p - proc;
+
     // set up the registers that trampoline.S's sret will use
     // to get to user space.
 
@@ -124,15 +153,22 @@ void usertrapret(void) {
     //! 将返回地址也设置好
     w_sepc(p->trapframe->epc);
 
+    // another thread may have given the address space an ASID
+    // of a newer generation meanwhile; this hart must flush
+    // before using it.
+    if (p->mm->asid >> 16 != mycpu()->asidgen)
+        asidswitch(p);
+
     // tell trampoline.S the user page table to switch to.
-    uint64 satp = MAKE_SATP(p->pagetable);
+    uint64 satp = MAKE_SATP(p->mm->pagetable, ASID(p->mm->asid));
 
     // jump to userret in trampoline.S at the top of memory, which
-    // switches to the user page table, restores user registers,
-    // and switches to user mode with sret.
+    // switches to the user page table, restores user registers
+    // from this thread's trapframe, and switches to user mode
+    // with sret.
     uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
     //! 从 userret (trampoline.S) 中恢复上下文和页表，回到用户态
-    ((void (*)(uint64))trampoline_userret)(satp);
+    ((void (*)(uint64, uint64))trampoline_userret)(satp, TRAPFRAME(p - proc));
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -155,10 +191,11 @@ void kerneltrap() {
         panic("kerneltrap");
     }
 
-    // give up the CPU if this is a timer interrupt.
-    //! 如果是 Timer Interrupt， yield 即可
+    // give up the CPU if this is a timer interrupt and the
+    // scheduler says so.
+    //! 如果是 Timer Interrupt， 由 preempt() 决定要不要 yield
     if (which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-        yield();
+        preempt();
 
     // the yield() may have caused some traps to occur,
     // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -166,13 +203,126 @@ void kerneltrap() {
     w_sstatus(sstatus);
 }
 
+// Send an IPI (a supervisor software interrupt) to hart.
+// The CLINT raises a machine software interrupt there,
+// which timervec in kernelvec.S passes on.
+void ipi(int hart) {
+    __sync_synchronize();
+    *(uint32*)CLINT_MSIP(hart) = 1;
+}
+
+static void timerput(int i, struct proc* p) {
+    timers[i] = p;
+    p->timer = i;
+}
+
+// Move timers[i] up or down the heap to where it belongs.
+static void timerfix(int i) {
+    struct proc* p = timers[i];
+    int c;
+
+    while (i > 0 && p->wakeat < timers[(i - 1) / 2]->wakeat) {
+        timerput(i, timers[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    while ((c = 2 * i + 1) < ntimers) {
+        if (c + 1 < ntimers && timers[c + 1]->wakeat < timers[c]->wakeat)
+            c++;
+        if (timers[c]->wakeat >= p->wakeat)
+            break;
+        timerput(i, timers[c]);
+        i = c;
+    }
+    timerput(i, p);
+    wakeat = timers[0]->wakeat;
+}
+
+// Take p out of the heap, if it is in it.
+static void timerdel(struct proc* p) {
+    int i = p->timer;
+
+    if (i < 0)
+        return;
+    p->timer = -1;
+    if (--ntimers == 0) {
+        wakeat = NOWAKE;
+        return;
+    }
+    if (i < ntimers) {
+        timers[i] = timers[ntimers];
+        timerfix(i);
+    }
+    wakeat = timers[0]->wakeat;
+}
+
+// Bring ticks up to date with the time CSR, and wake up each
+// sleeper whose time has come.  Harts do not tick when they
+// have nothing to do, so ticks is only as fresh as the last
+// call.
+// Caller must hold tickslock.
+void tickupdate(void) {
+    struct proc* p;
+    uint64 now = r_time();
+
+    ticks = now / TICKCYCLES;
+    while (ntimers > 0 && wakeat <= now) {
+        p = timers[0];
+        timerdel(p);
+        wakeup(&p->wakeat);
+    }
+}
+
+// Sleep until the time CSR reaches t.  The process waits in
+// the timer heap on a channel of its own, so tickupdate()
+// wakes it once, when t comes, and nobody else.  With Sstc
+// the hart's next timer interrupt is programmed for t, so t
+// need not be on a tick; without it, the wait is rounded up
+// to the next tick.
+// Caller must hold tickslock.  Returns -1 if killed, else 0.
+int timesleep(uint64 t) {
+    struct proc* p = myproc();
+
+    while (r_time() < t) {
+        if (killed(p)) {
+            timerdel(p);
+            return -1;
+        }
+        if (p->timer < 0) {
+            p->wakeat = t;
+            p->timer = ntimers++;
+            timers[p->timer] = p;
+            timerfix(p->timer);
+        }
+        sleep(&p->wakeat, &tickslock);
+    }
+    return 0;
+}
+
 void clockintr() {
     acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
+    tickupdate();
     release(&tickslock);
 }
 
+// Program this hart's next timer interrupt, with Sstc: a tick
+// from now if it runs a process, to end the time slice, and
+// no later than the earliest sleeper's deadline.  An idle
+// hart gets no interrupt before then, or none at all if
+// nobody sleeps.  Without Sstc the machine-mode timer keeps
+// ticking instead.
+void timerset(void) {
+    uint64 when = ~0ULL, w = wakeat;
+
+    if (!sstc)
+        return;
+    if (myproc() != 0)
+        when = r_time() + TICKCYCLES;
+    //! 不加锁读 wakeat: 登记睡眠的 hart 自己之后还会再调用这里
+    if (w < when)
+        when = w;
+    w_stimecmp(when);
+}
+
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -203,16 +353,32 @@ int devintr() {
 
         return 1;
     } else if (scause == 0x8000000000000001L) {
-        // software interrupt from a machine-mode timer interrupt,
-        // forwarded by timervec in kernelvec.S.
+        // software interrupt from a machine-mode timer interrupt
+        // or an IPI, forwarded by timervec in kernelvec.S.
+
+        // acknowledge the software interrupt by clearing
+        // the SSIP bit in sip, before looking at what it
+        // was for, so that no new request is missed.
+        w_sip(r_sip() & ~2);
+
+        // TLB shootdowns asked for by other harts.
+        tlbintr();
+
+        //! IPI 和时钟都是同一个软件中断, 靠 timervec 留下的标志区分
+        if (__sync_lock_test_and_set(&timer_scratch[cpuid()][6], 0) == 0)
+            return 1;
 
         if (cpuid() == 0) {
             clockintr();
         }
 
-        // acknowledge the software interrupt by clearing
-        // the SSIP bit in sip.
-        w_sip(r_sip() & ~2);
+        return 2;
+    } else if (scause == 0x8000000000000005L) {
+        // supervisor timer interrupt (Sstc), at the time
+        // timerset() asked for.  programming the next one
+        // clears it.
+        clockintr();
+        timerset();
 
         return 2;
     } else {
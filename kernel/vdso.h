@@ -0,0 +1,18 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include "param.h"
+#include "types.h"
+
+// The page the kernel maps read-only at VDSO in every user
+// address space, so that user code can learn the time and
+// its pid without a system call; see ugetpid() and friends
+// in user/ulib.c.  User mode reads the time CSR itself; the
+// page says how to turn its cycles into ticks and seconds.
+struct vdso {
+    uint64 timefreq;    // Cycles of the time CSR per second
+    uint64 tickcycles;  // Cycles of the time CSR per tick
+    int pid[NPROC];     // pid of the thread in each proc slot, or 0
+};
+
+#endif
@@ -3,7 +3,9 @@
 #include "fs.h"
 #include "memlayout.h"
 #include "param.h"
+#include "proc.h"
 #include "riscv.h"
+#include "spinlock.h"
 #include "types.h"
 
 /*
@@ -20,8 +22,7 @@ pagetable_t kvmmake(void) {
     pagetable_t kpgtbl;
 
     //! 申请一块物理内存作为内核页表
-    kpgtbl = (pagetable_t)kalloc();
-    memset(kpgtbl, 0, PGSIZE);
+    kpgtbl = (pagetable_t)kzalloc();
 
     //! 依次把虚拟内存空间映射过去
     //! 除了最后的 trampoline 之外，其他的都是直接映射
@@ -32,6 +33,10 @@ pagetable_t kvmmake(void) {
     // virtio mmio disk interface
     kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+    // CLINT, for ipi() in trap.c to raise software interrupts
+    // on other harts.
+    kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
     // PLIC
     kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -39,6 +44,9 @@ pagetable_t kvmmake(void) {
     kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext - KERNBASE, PTE_R | PTE_X);
 
     // map kernel data and the physical RAM we'll make use of.
+    // from the first 2 MB boundary after etext on, mappages()
+    // uses megapages, so this takes a handful of page-table
+    // pages instead of one per 2 MB.
     kvmmap(kpgtbl, (uint64)etext, (uint64)etext, PHYSTOP - (uint64)etext, PTE_R | PTE_W);
 
     // map the trampoline for trap entry/exit to
@@ -52,10 +60,27 @@ pagetable_t kvmmake(void) {
     return kpgtbl;
 }
 
+#ifdef VMDEBUG
+// Count the page-table pages of pagetable.
+static int ptpages(pagetable_t pagetable) {
+    int n = 1;
+
+    for (int i = 0; i < 512; i++) {
+        pte_t pte = pagetable[i];
+        if ((pte & PTE_V) && !PTE_LEAF(pte))
+            n += ptpages((pagetable_t)PTE2PA(pte));
+    }
+    return n;
+}
+#endif
+
 // Initialize the one kernel_pagetable
 void kvminit(void) {
     //! 核心的就是设置一个全局的内核页表
     kernel_pagetable = kvmmake();
+#ifdef VMDEBUG
+    printf("kvminit: kernel page table uses %d pages\n", ptpages(kernel_pagetable));
+#endif
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -64,12 +89,191 @@ void kvminithart() {
     // wait for any previous writes to the page table memory to finish.
     sfence_vma();
 
-    w_satp(MAKE_SATP(kernel_pagetable));
+    w_satp(MAKE_SATP(kernel_pagetable, 0));
 
     // flush stale entries from the TLB.
     sfence_vma();
 }
 
+// Address-space identifiers.
+//
+// Every user page table runs with its own ASID in satp, and
+// the kernel's with ASID 0, so the trampoline does not flush
+// the TLB when it switches between them, and mapping changes
+// flush only the entries of one page of one address space.
+// ASIDs are handed out in increasing order; when they run
+// out, a new generation starts, every address space gets a
+// new ASID when it next runs, and every hart flushes its
+// whole TLB before running anything of the new generation.
+//
+// An address space's entries can also be in the TLB of other
+// harts, where it ran before or where another of its threads
+// runs now.  mm->tlbmask has a bit for every hart whose TLB
+// holds no stale entries of it.  After a change, uvmflush()
+// flushes this hart's entries and tlbshootdown() deals with
+// the others: harts running a thread of the address space
+// get an IPI and flush at once; the rest lose their bit and
+// flush the ASID when they next run it.  If satp implements
+// no ASID bits, everything runs with ASID 0 and the
+// trampoline flushes.
+
+static struct spinlock asidlock;
+static uint64 asidgen = 1;   // current generation
+static uint64 nextasid = 1;  // next free ASID in this generation
+static uint64 asidmax;       // largest ASID, 0 if none
+
+// Find out how many ASID bits satp implements: write all
+// ones to the field and see which bits stick.
+void asidinit(void) {
+    initlock(&asidlock, "asid");
+    w_satp(MAKE_SATP(kernel_pagetable, SATP_ASIDMASK));
+    asidmax = (r_satp() >> SATP_ASIDSHIFT) & SATP_ASIDMASK;
+    w_satp(MAKE_SATP(kernel_pagetable, 0));
+    sfence_vma();
+#ifdef VMDEBUG
+    printf("asidinit: %d ASIDs\n", (int)asidmax);
+#endif
+}
+
+// Clear the tlbmask bits of mm for the harts that do not run
+// it now, so that they flush it before they next do.
+// Caller must hold asidlock.
+static void forget(struct mm* mm) {
+    for (int i = 0; i < NCPU; i++) {
+        if (cpus[i].mm != mm)
+            mm->tlbmask &= ~(1UL << i);
+    }
+}
+
+// Make this hart's TLB ready to run p: give p's address space
+// an ASID of the current generation, and flush whatever
+// entries of it (or of an old generation) may be stale here.
+// Called by the scheduler, and by usertrapret() when another
+// thread gave the address space a new ASID meanwhile.
+void asidswitch(struct proc* p) {
+    struct mm* mm = p->mm;
+    struct cpu* c;
+    uint64 bit;
+
+    //! exit() 已经放下了地址空间, 不会再回到用户态
+    if (mm == 0)
+        return;
+    push_off();
+    c = mycpu();
+    bit = 1UL << cpuid();
+    acquire(&asidlock);
+    if (asidmax != 0 && mm->asid >> 16 != asidgen) {
+        //! ASID 用完了, 开始新的一代
+        if (nextasid > asidmax) {
+            asidgen++;
+            nextasid = 1;
+        }
+        mm->asid = asidgen << 16 | nextasid++;
+        forget(mm);
+    }
+    if (asidmax != 0 && c->asidgen != asidgen) {
+        sfence_vma();
+        c->asidgen = asidgen;
+    } else if ((mm->tlbmask & bit) == 0) {
+        sfence_vma_asid(ASID(mm->asid));
+    }
+    //! 设置 c->mm 和 tlbmask 都在 asidlock 下, tlbshootdown() 看到的是一致的
+    mm->tlbmask |= bit;
+    c->mm = mm;
+    release(&asidlock);
+    pop_off();
+}
+
+// This hart no longer runs a thread of the address space it
+// ran: the thread was switched out, or dropped it in exit().
+// No lock: tlbshootdown() seeing the old value only costs an
+// extra IPI.
+void asidleave(void) {
+    push_off();
+    mycpu()->mm = 0;
+    pop_off();
+}
+
+// Handle TLB shootdown requests that other harts made of this
+// one: flush the whole TLB, which covers every ASID.
+void tlbintr(void) {
+    struct cpu* c;
+    uint64 req;
+
+    push_off();
+    c = mycpu();
+    req = *(volatile uint64*)&c->tlbreq;
+    if (req != c->tlbdone) {
+        __sync_synchronize();
+        sfence_vma();
+        __sync_synchronize();
+        *(volatile uint64*)&c->tlbdone = req;
+    }
+    pop_off();
+}
+
+// Flush this hart's TLB entries of npages pages of mm at va
+// after a change to its page table, and make the other harts
+// drop theirs.  Waits until the harts that run a thread of mm
+// have flushed, since the change may be about to free pages
+// they could still reach.
+// Must not be called with a spinlock held while other
+// threads of mm may be running: a hart spinning on that
+// lock with interrupts off would never answer.
+static void tlbshootdown(struct mm* mm, uint64 va, uint64 npages) {
+    uint64 want[NCPU], bit;
+    int i, n = 0, ok = cansleep();
+
+    //! 不能在刷完本地之后被换到别的 hart 上去
+    push_off();
+    if (npages == 1)
+        sfence_vma_page(va, ASID(mm->asid));
+    else
+        sfence_vma_asid(ASID(mm->asid));
+    bit = 1UL << cpuid();
+    __sync_synchronize();
+    //! 单线程的进程没有在别处运行, 常见情况下没有别的 hart 要管
+    if ((mm->tlbmask & ~bit) == 0) {
+        pop_off();
+        return;
+    }
+
+    acquire(&asidlock);
+    forget(mm);
+    for (i = 0; i < NCPU; i++) {
+        want[i] = 0;
+        if (cpus[i].mm == mm && (1UL << i) != bit) {
+            want[i] = __sync_add_and_fetch(&cpus[i].tlbreq, 1);
+            ipi(i);
+            n++;
+        }
+    }
+    release(&asidlock);
+
+    if (n > 0 && !ok)
+        panic("tlbshootdown");
+    //! 等的时候也处理别的 hart 发给自己的请求, 两个 hart 互相等也不会死锁
+    for (i = 0; i < NCPU; i++) {
+        while (want[i] != 0 && *(volatile uint64*)&cpus[i].tlbdone < want[i])
+            tlbintr();
+    }
+    pop_off();
+}
+
+// Flush the TLB entries of npages pages at va after their
+// mappings changed in pagetable, here and on the other harts.
+// Only the current address space's entries need flushing: a
+// page table that is not running is either fresh, about to
+// be freed, or gets flushed by asidswitch() when it runs on
+// a hart again.
+void uvmflush(pagetable_t pagetable, uint64 va, uint64 npages) {
+    struct proc* p = myproc();
+
+    if (p == 0 || p->mm == 0 || p->mm->pagetable != pagetable)
+        return;
+    tlbshootdown(p->mm, va, npages);
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc！=0,
 // create any required page-table pages.
@@ -85,30 +289,59 @@ void kvminithart() {
 //
 //! 该函数用于创建多级页表 ( 即在多级页表中申请新的虚拟地址 )
 pte_t* walk(pagetable_t pagetable, uint64 va, int alloc) {
+    return walklevel(pagetable, va, 0, alloc);
+}
+
+// Like walk(), but return the PTE at the given level
+// (1 for a 2 MB megapage, 0 for a 4 KB page).
+// A leaf found above that level is returned instead.
+pte_t* walklevel(pagetable_t pagetable, uint64 va, int target, int alloc) {
     if (va >= MAXVA)
         panic("walk");
 
-    //! 总共进行两次页表的读取
-    for (int level = 2; level > 0; level--) {
+    //! 从第二级往下走到 target 级
+    for (int level = 2; level > target; level--) {
         //! 找到对应的 PTE
         pte_t* pte = &pagetable[PX(level, va)];
         //! 已经存在该 PTE, 直接以它作为基准，寻找下一级的PTE
-        if (*pte & PTE_V) {
+        //! 如果它本身就是叶子 ( 超级页 ), 没有下一级了
+        if ((*pte & PTE_V) && PTE_LEAF(*pte)) {
+            return pte;
+        } else if (*pte & PTE_V) {
             pagetable = (pagetable_t)PTE2PA(*pte);
         } else {
             //! 否则创建一个新页表并配置 PTE
-            if (!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+            if (!alloc || (pagetable = (pde_t*)kzalloc()) == 0)
                 return 0;
-            memset(pagetable, 0, PGSIZE);
             *pte = PA2PTE(pagetable) | PTE_V;
         }
     }
-    //! 返回最后一级的 PTE
-    return &pagetable[PX(0, va)];
+    //! 返回 target 级的 PTE
+    return &pagetable[PX(target, va)];
+}
+
+// Return the leaf PTE that maps va in a user page table, and
+// set *pa to the physical address of the 4 KB page holding va;
+// for a megapage that is the matching page inside the 2 MB block.
+// Returns 0 if va is not mapped.
+static pte_t* uwalk(pagetable_t pagetable, uint64 va, uint64* pa) {
+    pte_t* pte;
+
+    if ((pte = walklevel(pagetable, va, 1, 0)) == 0 || (*pte & PTE_V) == 0)
+        return 0;
+    if (PTE_LEAF(*pte)) {
+        *pa = PTE2PA(*pte) + (PGROUNDDOWN(va) & (MEGAPGSIZE - 1));
+        return pte;
+    }
+    pte = &((pagetable_t)PTE2PA(*pte))[PX(0, va)];
+    if ((*pte & PTE_V) == 0)
+        return 0;
+    *pa = PTE2PA(*pte);
+    return pte;
 }
 
 // Look up a virtual address, return the physical address,
-// or 0 if not mapped.
+// or 0 if not mapped, or not readable by the user.
 // Can only be used to look up user pages.
 uint64 walkaddr(pagetable_t pagetable, uint64 va) {
     pte_t* pte;
@@ -117,14 +350,11 @@ uint64 walkaddr(pagetable_t pagetable, uint64 va) {
     if (va >= MAXVA)
         return 0;
 
-    pte = walk(pagetable, va, 0);
+    pte = uwalk(pagetable, va, &pa);
     if (pte == 0)
         return 0;
-    if ((*pte & PTE_V) == 0)
-        return 0;
-    if ((*pte & PTE_U) == 0)
+    if ((*pte & (PTE_U | PTE_R)) != (PTE_U | PTE_R))
         return 0;
-    pa = PTE2PA(*pte);
     return pa;
 }
 
@@ -138,10 +368,12 @@ void kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm) {
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Ranges of 2 MB whose va and pa are both
+// 2 MB-aligned get a single level-1 leaf (a megapage).
+// Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm) {
-    uint64 a, last;
+    uint64 a, last, sz;
     pte_t* pte;
 
     if (size == 0)
@@ -152,7 +384,11 @@ int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 
     for (;;) {
         //! walk 用于给定一个 VA, 创建一个对应的多级页表并返回 PTE 的地址
-        if ((pte = walk(pagetable, a, 1)) == 0)
+        //! 对齐的整 2 MB 用一级的叶子 PTE 映射, 省下一整页零级页表, 也只占一个 TLB 项
+        sz = PGSIZE;
+        if (a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && last - a >= MEGAPGSIZE - PGSIZE)
+            sz = MEGAPGSIZE;
+        if ((pte = walklevel(pagetable, a, sz == MEGAPGSIZE, 1)) == 0)
             return -1;
         if (*pte & PTE_V)
             panic("mappages: remap");
@@ -160,12 +396,12 @@ int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
         //! PTE 修改，指向对应的物理地址
         *pte = PA2PTE(pa) | perm | PTE_V;
 
-        if (a == last)
+        if (a + sz - PGSIZE == last)
             break;
 
-        a += PGSIZE;
+        a += sz;
 
-        pa += PGSIZE;
+        pa += sz;
     }
     return 0;
 }
@@ -181,11 +417,30 @@ void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
         panic("uvmunmap: not aligned");
 
     for (a = va; a < va + npages * PGSIZE; a += PGSIZE) {
+        //! 整个被释放的超级页一次释放; 只释放一部分的, 调用者要先 uvmsplit()
+        if ((pte = walklevel(pagetable, a, 1, 0)) != 0 && (*pte & PTE_V) && PTE_LEAF(*pte)) {
+            if (a % MEGAPGSIZE != 0 || a + MEGAPGSIZE > va + npages * PGSIZE)
+                panic("uvmunmap: part of a megapage");
+            if (do_free)
+                kfreemega((void*)PTE2PA(*pte));
+            *pte = 0;
+            a += MEGAPGSIZE - PGSIZE;
+            continue;
+        }
+
         //! 找到对应的 PTE
+        //! 堆是懒分配的, 没有被访问过的页根本不存在, 跳过即可
         if ((pte = walk(pagetable, a, 0)) == 0)
-            panic("uvmunmap: walk");
+            continue;
+        //! 被换出的页只需要释放它在交换区的槽
+        if (*pte & PTE_SWAP) {
+            if (do_free)
+                swapfree(*pte);
+            *pte = 0;
+            continue;
+        }
         if ((*pte & PTE_V) == 0)
-            panic("uvmunmap: not mapped");
+            continue;
         if (PTE_FLAGS(*pte) == PTE_V)
             panic("uvmunmap: not a leaf");
 
@@ -198,16 +453,16 @@ void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
         }
         *pte = 0;
     }
+    uvmflush(pagetable, va, npages);
 }
 
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t uvmcreate() {
     pagetable_t pagetable;
-    pagetable = (pagetable_t)kalloc();
+    pagetable = (pagetable_t)kzalloc();
     if (pagetable == 0)
         return 0;
-    memset(pagetable, 0, PGSIZE);
     return pagetable;
 }
 
@@ -221,9 +476,7 @@ void uvmfirst(pagetable_t pagetable, uchar* src, uint sz) {
     if (sz >= PGSIZE)
         panic("uvmfirst: more than a page");
 
-    mem = kalloc();
-
-    memset(mem, 0, PGSIZE);
+    mem = kzalloc();
 
     mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W | PTE_R | PTE_X | PTE_U);
 
@@ -252,7 +505,7 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
     //! 依次申请新块，并添加对应的页表映射，直到到达新的大小
     //! ( 如果新申请的大小还没超过当前的块边界，不会进入循环，会直接返回 newsz )
     for (a = oldsz; a < newsz; a += PGSIZE) {
-        mem = kalloc();
+        mem = ualloc(1);
 
         //! 异常处理
         if (mem == 0) {
@@ -260,8 +513,6 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
             return 0;
         }
 
-        memset(mem, 0, PGSIZE);
-
         //! 执行 mappages, 将 a 添加到 PTE 中
         if (mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R | PTE_U | xperm) != 0) {
             kfree(mem);
@@ -284,6 +535,10 @@ uint64 uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
     if (newsz >= oldsz)
         return oldsz;
 
+    //! 新的结尾落在一个超级页中间, 先把它拆开
+    if (PGROUNDUP(newsz) % MEGAPGSIZE != 0 && uvmsplit(pagetable, PGROUNDUP(newsz)) < 0)
+        return oldsz;
+
     if (PGROUNDUP(newsz) < PGROUNDUP(oldsz)) {
         // ! 将该区间的每一个页都取消映射
         int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
@@ -299,7 +554,7 @@ void freewalk(pagetable_t pagetable) {
     // there are 2^9 = 512 PTEs in a page table.
     for (int i = 0; i < 512; i++) {
         pte_t pte = pagetable[i];
-        if ((pte & PTE_V) && (pte & (PTE_R | PTE_W | PTE_X)) == 0) {
+        if ((pte & PTE_V) && !PTE_LEAF(pte)) {
             // this PTE points to a lower-level page table.
             uint64 child = PTE2PA(pte);
             freewalk((pagetable_t)child);
@@ -321,38 +576,101 @@ void uvmfree(pagetable_t pagetable, uint64 sz) {
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies the page table, but shares the physical
+// memory: writable pages become read-only and
+// PTE_COW in both parent and child, and are copied
+// by cowfault() on the first write.  Megapages are
+// shared whole, at level 1.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int uvmcopy(pagetable_t old, pagetable_t new, uint64 sz) {
-    pte_t* pte;
+    return uvmcopyrange(old, new, 0, sz, 0);
+}
+
+// Like uvmcopy(), for the pages in [start, end).
+// If share is set, writable pages stay writable in both
+// page tables (MAP_SHARED) instead of becoming COW.
+int uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int share) {
+    pte_t *pte, *npte;
     uint64 pa, i;
     uint flags;
-    char* mem;
 
-    for (i = 0; i < sz; i += PGSIZE) {
+    for (i = start; i < end; i += PGSIZE) {
+        //! 整个在范围内的超级页在一级共享, 父子进程都保留 2 MB 的映射
+        //! 只有一部分在范围内的超级页才拆成 4 KB 的页再按页共享
+        if (i == start || i % MEGAPGSIZE == 0) {
+            pte = walklevel(old, i, 1, 0);
+            if (pte && (*pte & PTE_V) && PTE_LEAF(*pte) && i % MEGAPGSIZE == 0 && i + MEGAPGSIZE <= end) {
+                if ((*pte & PTE_W) && !share)
+                    *pte = (*pte & ~PTE_W) | PTE_COW;
+                pa = PTE2PA(*pte);
+                if (mappages(new, i, MEGAPGSIZE, pa, PTE_FLAGS(*pte)) != 0)
+                    goto err;
+                kdupmega((void*)pa);
+                i += MEGAPGSIZE - PGSIZE;
+                continue;
+            }
+            if (uvmsplit(old, i) < 0)
+                goto err;
+        }
+        //! 父进程还没碰过的懒分配页, 子进程以后自己再分配
         if ((pte = walk(old, i, 0)) == 0)
-            panic("uvmcopy: pte should exist");
+            continue;
+        //! 被换出的页, 子进程和父进程共用交换区里的同一个槽
+        //! 谁先换入谁就得到自己的一份
+        if (*pte & PTE_SWAP) {
+            if ((npte = walk(new, i, 1)) == 0)
+                goto err;
+            *npte = *pte;
+            swapdup(*pte);
+            continue;
+        }
         if ((*pte & PTE_V) == 0)
-            panic("uvmcopy: page not present");
+            continue;
+        //! 可写页在父子进程中都变成只读的 COW 页
+        //! 只读页 ( 例如代码段 ) 本来就不会被写，直接共享即可
+        if ((*pte & PTE_W) && !share)
+            *pte = (*pte & ~PTE_W) | PTE_COW;
         pa = PTE2PA(*pte);
         flags = PTE_FLAGS(*pte);
-        if ((mem = kalloc()) == 0)
-            goto err;
-        memmove(mem, (char*)pa, PGSIZE);
-        if (mappages(new, i, PGSIZE, (uint64)mem, flags) != 0) {
-            kfree(mem);
+        if (mappages(new, i, PGSIZE, pa, flags) != 0)
             goto err;
-        }
+        kdup((void*)pa);
     }
+    //! 父进程的页变成只读了, TLB 中可能还有可写的旧项
+    uvmflush(old, start, (end - start) / PGSIZE);
     return 0;
 
 err:
-    uvmunmap(new, 0, i / PGSIZE, 1);
+    uvmflush(old, start, (end - start) / PGSIZE);
+    uvmunmap(new, start, (i - start) / PGSIZE, 1);
     return -1;
 }
 
+// If va is mapped by a megapage, replace it with a level-0
+// page table of 512 PTEs for the same memory and permissions,
+// so that parts of it can be freed or shared copy-on-write.
+// Returns 0 on success (or if there is no megapage at va),
+// -1 if there is no memory for the page-table page.
+int uvmsplit(pagetable_t pagetable, uint64 va) {
+    pagetable_t l0;
+    pte_t* pte;
+    uint64 pa;
+    uint flags;
+
+    if ((pte = walklevel(pagetable, va, 1, 0)) == 0 || (*pte & PTE_V) == 0 || !PTE_LEAF(*pte))
+        return 0;
+    if ((l0 = (pagetable_t)kalloc()) == 0)
+        return -1;
+    pa = PTE2PA(*pte);
+    flags = PTE_FLAGS(*pte);
+    for (int i = 0; i < 512; i++)
+        l0[i] = PA2PTE(pa + i * PGSIZE) | flags;
+    *pte = PA2PTE(l0) | PTE_V;
+    uvmflush(pagetable, va, 1);
+    return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void uvmclear(pagetable_t pagetable, uint64 va) {
@@ -364,17 +682,233 @@ void uvmclear(pagetable_t pagetable, uint64 va) {
     *pte &= ~PTE_U;
 }
 
+// Resolve a write to the copy-on-write megapage *pte around
+// va: make it writable again if nobody else refers to it, or
+// give the page table its own copy of the 2 MB.  Only when
+// there is no free 2 MB block is it split, and the page at va
+// copied alone.
+static int cowmega(pagetable_t pagetable, uint64 va, pte_t* pte) {
+    uint64 m = MEGAROUNDDOWN(va), pa = PTE2PA(*pte);
+    uint flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+    char* mem;
+
+    if (!kmegashared((void*)pa)) {
+        *pte = PA2PTE(pa) | flags;
+        uvmflush(pagetable, m, 1);
+        return 0;
+    }
+    if ((mem = kallocmega()) != 0) {
+        memmove(mem, (char*)pa, MEGAPGSIZE);
+        *pte = PA2PTE(mem) | flags;
+        uvmflush(pagetable, m, 1);
+        kfreemega((void*)pa);
+        return 0;
+    }
+    if (uvmsplit(pagetable, m) < 0)
+        return -1;
+    return cowfault(pagetable, va);
+}
+
+// Resolve a write to the copy-on-write page at va:
+// give the page table its own writable copy, or, if
+// nobody else refers to the page any more, simply
+// make it writable again.
+// Returns 0 on success, -1 if va is not a COW page
+// or memory ran out.
+int cowfault(pagetable_t pagetable, uint64 va) {
+    pte_t* pte;
+    uint64 pa;
+    uint flags;
+    char* mem;
+
+    if (va >= MAXVA)
+        return -1;
+    va = PGROUNDDOWN(va);
+    if ((pte = walk(pagetable, va, 0)) == 0)
+        return -1;
+    if ((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0)
+        return -1;
+    if (pte == walklevel(pagetable, va, 1, 0))
+        return cowmega(pagetable, va, pte);
+
+    pa = PTE2PA(*pte);
+    flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+
+    //! 只剩自己在用这一页了，不必复制
+    if (krefcnt((void*)pa) == 1) {
+        *pte = PA2PTE(pa) | flags;
+        uvmflush(pagetable, va, 1);
+        return 0;
+    }
+
+    if ((mem = ualloc(0)) == 0)
+        return -1;
+    memmove(mem, (char*)pa, PGSIZE);
+    *pte = PA2PTE(mem) | flags;
+    uvmflush(pagetable, va, 1);
+    kfree((void*)pa);
+    return 0;
+}
+
+// Back the whole 2 MB-aligned part of mm's heap around va
+// with a zeroed megapage (a transparent huge page), if the
+// heap is big, that part lies entirely inside it, and none of
+// it is mapped yet.  Returns 0 if it did, -1 to fall back to
+// 4 KB.
+static int hugefault(struct mm* mm, uint64 va) {
+    uint64 m = MEGAROUNDDOWN(va);
+    pte_t* pte;
+    char* mem;
+
+    if (mm->sz < THPMIN || m + MEGAPGSIZE > mm->sz || vmaoverlap(mm, m, m + MEGAPGSIZE))
+        return -1;
+    //! 一级 PTE 有效说明这 2 MB 中已经有 4 KB 的页了
+    if ((pte = walklevel(mm->pagetable, m, 1, 1)) == 0 || (*pte & PTE_V))
+        return -1;
+    if ((mem = kallocmega()) == 0)
+        return -1;
+    for (int i = 0; i < MEGAPGSIZE / PGSIZE; i++)
+        pagezero(mem + i * PGSIZE);
+    *pte = PA2PTE(mem) | PTE_R | PTE_W | PTE_U | PTE_V;
+    uvmflush(mm->pagetable, m, 1);
+    return 0;
+}
+
+// The body of vmfault(), for address space mm, or for a page
+// table that is not running yet if mm is 0.
+static int fault(struct mm* mm, pagetable_t pagetable, uint64 va, int access) {
+    struct vma* v;
+    pte_t* pte;
+    char* mem;
+
+    pte = walk(pagetable, va, 0);
+    if (pte != 0 && (*pte & PTE_V) && (*pte & PTE_U) && (*pte & access)) {
+        //! 另一个线程已经先把这一页弄好了, 或者硬件不自己置 A/D 位
+        *pte |= PTE_AD(access);
+        if (mm)
+            sfence_vma_page(va, ASID(mm->asid));
+    } else if (pte != 0 && (*pte & PTE_V)) {
+        //! 页已经存在, 只可能是对 COW 页的写
+        if (access != PTE_W || cowfault(pagetable, va) < 0)
+            return -1;
+    } else if (mm == 0) {
+        return -1;
+    } else if (pte != 0 && (*pte & PTE_SWAP)) {
+        //! 被换出到磁盘上的页, 读回来
+        if (swapin(pagetable, va, access) < 0)
+            return -1;
+    } else if ((v = vmalookup(mm, va)) != 0) {
+        //! 程序映像和 mmap 的区域, 从文件读入或者填 0; 区域不允许的访问 (包括 PROT_NONE) 是真的错误
+        if ((v->perm & access) == 0 || vmaload(mm, v, va, access) < 0)
+            return -1;
+    } else if (va >= mm->sz) {
+        return -1;
+    } else if (hugefault(mm, va) == 0) {
+        //! 大堆中整个 2 MB 都还空着, 用一个超级页
+    } else {
+        //! 其余的 (堆) 是全 0 的页
+        if ((mem = ualloc(1)) == 0)
+            return -1;
+        if (mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R | PTE_W | PTE_U | PTE_AD(access)) != 0) {
+            kfree(mem);
+            return -1;
+        }
+        uvmflush(pagetable, va, 1);
+    }
+    return 0;
+}
+
+// Handle a page fault at va in the current process, for an
+// access that needs permission access (PTE_R, PTE_W or
+// PTE_X): read the page back if it was swapped out (see
+// swap.c), fill the page in if va lies in a region (see
+// vma.c), map a fresh zeroed page if it lies in the part of
+// the heap that sbrk() grew but nobody has touched yet (a
+// whole megapage at once when the heap is big), or break
+// copy-on-write sharing if the access is a write.  Holds the
+// address space's lock, since other threads may be faulting
+// on the same page.
+// Returns 0 if the faulting access can be retried,
+// -1 if it is a genuine fault.
+int vmfault(pagetable_t pagetable, uint64 va, int access) {
+    struct proc* p = myproc();
+    struct mm* mm = p ? p->mm : 0;
+    int r;
+
+    if (va >= MAXVA)
+        return -1;
+    va = PGROUNDDOWN(va);
+    //! exec() 正在建的新页表还没有别人在用
+    if (mm == 0 || mm->pagetable != pagetable) {
+        r = fault(0, pagetable, va, access);
+    } else {
+        if (mmlock(mm) < 0)
+            return -1;
+        r = fault(mm, pagetable, va, access);
+        mmunlock(mm);
+    }
+    if (r == 0 && p)
+        p->pgfaults++;
+    return r;
+}
+
+// Look up a virtual address for writing: like walkaddr(),
+// but returns 0 unless the page is writable now, so never a
+// copy-on-write page, whose physical address is about to
+// change.
+uint64 walkwaddr(pagetable_t pagetable, uint64 va) {
+    pte_t* pte;
+    uint64 pa;
+
+    if (va >= MAXVA || (pte = uwalk(pagetable, va, &pa)) == 0)
+        return 0;
+    if ((*pte & (PTE_U | PTE_W)) != (PTE_U | PTE_W))
+        return 0;
+    return pa;
+}
+
+// Keep reclaim() from swapping out the current process's
+// user page at va while the kernel reads or writes it
+// through its physical address, which may span a sleep or
+// a preemption.  One page at a time; uunpin() lets it go.
+void upin(uint64 va) {
+    struct proc* p = myproc();
+
+    if (p)
+        p->pinva = PGROUNDDOWN(va);
+}
+
+void uunpin(void) {
+    struct proc* p = myproc();
+
+    if (p)
+        p->pinva = MAXVA;
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
 int copyout(pagetable_t pagetable, uint64 dstva, char* src, uint64 len) {
     uint64 n, va0, pa0;
+    pte_t* pte;
 
     while (len > 0) {
         va0 = PGROUNDDOWN(dstva);
-        pa0 = walkaddr(pagetable, va0);
-        if (pa0 == 0)
-            return -1;
+        if (va0 >= MAXVA)
+            break;
+        upin(va0);
+        pte = uwalk(pagetable, va0, &pa0);
+        //! 写之前先把懒分配的页分配出来, 或者把 COW 页复制出来
+        if (pte == 0 || (*pte & PTE_COW)) {
+            if (vmfault(pagetable, va0, PTE_W) < 0)
+                break;
+            if ((pte = uwalk(pagetable, va0, &pa0)) == 0)
+                break;
+        }
+        if ((*pte & PTE_U) == 0 || (*pte & PTE_W) == 0)
+            break;
+        //! 内核通过物理地址写, 硬件不会置 D 位, 自己置上 (munmap 据此写回)
+        *pte |= PTE_D;
         n = PGSIZE - (dstva - va0);
         if (n > len)
             n = len;
@@ -384,7 +918,8 @@ int copyout(pagetable_t pagetable, uint64 dstva, char* src, uint64 len) {
         src += n;
         dstva = va0 + PGSIZE;
     }
-    return 0;
+    uunpin();
+    return len == 0 ? 0 : -1;
 }
 
 // Copy from user to kernel.
@@ -395,9 +930,12 @@ int copyin(pagetable_t pagetable, char* dst, uint64 srcva, uint64 len) {
 
     while (len > 0) {
         va0 = PGROUNDDOWN(srcva);
+        upin(va0);
         pa0 = walkaddr(pagetable, va0);
-        if (pa0 == 0)
-            return -1;
+        if (pa0 == 0) {
+            if (vmfault(pagetable, va0, PTE_R) < 0 || (pa0 = walkaddr(pagetable, va0)) == 0)
+                break;
+        }
         n = PGSIZE - (srcva - va0);
         if (n > len)
             n = len;
@@ -407,7 +945,8 @@ int copyin(pagetable_t pagetable, char* dst, uint64 srcva, uint64 len) {
         dst += n;
         srcva = va0 + PGSIZE;
     }
-    return 0;
+    uunpin();
+    return len == 0 ? 0 : -1;
 }
 
 // Copy a null-terminated string from user to kernel.
@@ -420,9 +959,12 @@ int copyinstr(pagetable_t pagetable, char* dst, uint64 srcva, uint64 max) {
 
     while (got_null == 0 && max > 0) {
         va0 = PGROUNDDOWN(srcva);
+        upin(va0);
         pa0 = walkaddr(pagetable, va0);
-        if (pa0 == 0)
-            return -1;
+        if (pa0 == 0) {
+            if (vmfault(pagetable, va0, PTE_R) < 0 || (pa0 = walkaddr(pagetable, va0)) == 0)
+                break;
+        }
         n = PGSIZE - (srcva - va0);
         if (n > max)
             n = max;
@@ -444,6 +986,7 @@ int copyinstr(pagetable_t pagetable, char* dst, uint64 srcva, uint64 max) {
 
         srcva = va0 + PGSIZE;
     }
+    uunpin();
     if (got_null) {
         return 0;
     } else {
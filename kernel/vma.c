@@ -0,0 +1,453 @@
+// Regions of user memory that are filled in on demand.
+//
+// exec() does not read a program into memory.  It records,
+// for every loadable segment, which part of the inode the
+// segment's pages come from, and vmfault() reads a page in
+// when the program first touches it.  So starting a program
+// costs only the pages it actually uses.  mmap() creates the
+// same kind of region, for a file or for anonymous memory,
+// below MMAPTOP; MAP_SHARED file pages that were written are
+// put back into the file when they are unmapped.  Regions of
+// shared memory objects (shm.c) get their pages from the
+// object.
+//
+// The regions live in the address space (struct mm), which
+// threads made by clone() share; mm->lock serializes changes
+// to them and page faults, see mmlock().
+//
+// The kernel copies to and from user memory with locks held
+// (a pipe's lock, the inode being read, ...), and must not
+// sleep on the disk or on mm->lock there; vmaprefault() lets
+// system calls fault the pages of a user buffer in first.
+
+#include "defs.h"
+#include "fcntl.h"
+#include "file.h"
+#include "fs.h"
+#include "memlayout.h"
+#include "param.h"
+#include "proc.h"
+#include "riscv.h"
+#include "sleeplock.h"
+#include "spinlock.h"
+#include "stat.h"
+#include "types.h"
+
+// Return the region of mm that contains va, or 0.
+struct vma* vmalookup(struct mm* mm, uint64 va) {
+    struct vma* v;
+
+    for (v = mm->vmas; v < &mm->vmas[NVMA]; v++) {
+        if (va >= v->start && va < v->end)
+            return v;
+    }
+    return 0;
+}
+
+// Whether the current process may wait for an inode and the
+// disk: it holds no spinlock, and no sleep-lock but mm's.
+static int canread(struct mm* mm) {
+    return cansleep() && myproc()->sleeplocks <= (holdingsleep(&mm->lock) ? 1 : 0);
+}
+
+// Fill in the page at va, which must lie in region v of mm,
+// from the file or with zeros, and map it; or map the page
+// of the shared memory object.  A PROT_NONE region gets no
+// pages: every access to it faults.  Caller must hold mmlock().
+// Returns 0 on success, -1 on failure, or if the page must
+// be read from the file and the caller cannot sleep.
+int vmaload(struct mm* mm, struct vma* v, uint64 va, int access) {
+    uint64 off, n;
+    pte_t* pte;
+    char* mem;
+
+    va = PGROUNDDOWN(va);
+    //! PROT_NONE 的区域不能有 PTE: R=W=X=0 的 PTE 在 Sv39 里是指向下一级页表的
+    if ((v->perm & (PTE_R | PTE_W | PTE_X)) == 0)
+        return -1;
+    if (v->shm) {
+        //! 共享内存的页属于对象, 这里只是多一个引用; 不会睡眠
+        mem = shmpage(v->shm, v->off + (va - v->start));
+        kdup(mem);
+        if (mappages(mm->pagetable, va, PGSIZE, (uint64)mem, v->perm | PTE_AD(access)) != 0) {
+            kfree(mem);
+            return -1;
+        }
+        uvmflush(mm->pagetable, va, 1);
+        return 0;
+    }
+    //! 拿着自旋锁 (pipe, console) 或者别的 inode 时不能去 ilock, 由调用者先 vmaprefault()
+    off = va - v->start;
+    if (v->ip && off < v->filesz && !canread(mm))
+        return -1;
+    if ((mem = ualloc(1)) == 0)
+        return -1;
+
+    //! 跨过 filesz 的那一页只读一部分, 剩下的 (bss) 保持为 0
+    //! 文件结尾之后的部分 readi 读不到, 同样是 0
+    if (v->ip && off < v->filesz) {
+        n = v->filesz - off;
+        if (n > PGSIZE)
+            n = PGSIZE;
+        ilock(v->ip);
+        if (readi(v->ip, 0, (uint64)mem, v->off + off, n) < 0) {
+            iunlock(v->ip);
+            kfree(mem);
+            return -1;
+        }
+        iunlock(v->ip);
+    }
+
+    //! 读盘时睡眠过, 页可能已经被别人映射了
+    if ((pte = walk(mm->pagetable, va, 0)) != 0 && (*pte & (PTE_V | PTE_SWAP))) {
+        kfree(mem);
+        return 0;
+    }
+    if (mappages(mm->pagetable, va, PGSIZE, (uint64)mem, v->perm | PTE_AD(access)) != 0) {
+        kfree(mem);
+        return -1;
+    }
+    uvmflush(mm->pagetable, va, 1);
+    return 0;
+}
+
+// Fault in the pages of the current process in [va, va+len)
+// that are not mapped yet, or are copy-on-write if write is
+// set, so that copying to or from them later does not need
+// the disk or mm->lock.  The pages stay pinned against
+// reclaim() until the system call returns (see syscall()).
+void vmaprefault(uint64 va, int len, int write) {
+    struct proc* p = myproc();
+    pagetable_t pagetable = p->mm->pagetable;
+    uint64 a;
+    pte_t* pte;
+
+    if (len <= 0 || va + len < va || va + len > MAXVA)
+        return;
+    //! 之后可能拿着自旋锁拷贝, 那时换出的页读不回来
+    if (p->pfstart == p->pfend || PGROUNDDOWN(va) < p->pfstart)
+        p->pfstart = PGROUNDDOWN(va);
+    if (PGROUNDUP(va + len) > p->pfend)
+        p->pfend = PGROUNDUP(va + len);
+    for (a = PGROUNDDOWN(va); a < va + len; a += PGSIZE) {
+        pte = walk(pagetable, a, 0);
+        if (pte != 0 && (*pte & PTE_V) && !(write && (*pte & PTE_COW)))
+            continue;
+        //! 失败就算了, 真正拷贝时会报错
+        if (vmfault(pagetable, a, write ? PTE_W : PTE_R) < 0)
+            return;
+    }
+}
+
+// Fill in every page of mm's MAP_SHARED regions, so that a
+// child forked next shares all of them with mm instead of
+// faulting in pages of its own.  May sleep on the disk, so
+// fork() calls it before taking any spinlock.  Caller must
+// hold mmlock().
+// Returns 0 on success, -1 on failure.
+int vmashare(struct mm* mm) {
+    struct vma* v;
+    uint64 a;
+    pte_t* pte;
+
+    for (v = mm->vmas; v < &mm->vmas[NVMA]; v++) {
+        //! 共享内存对象的页子进程自己从对象拿
+        if ((v->flags & MAP_SHARED) == 0 || v->shm || (v->perm & (PTE_R | PTE_W | PTE_X)) == 0)
+            continue;
+        for (a = v->start; a < v->end; a += PGSIZE) {
+            if ((pte = walk(mm->pagetable, a, 0)) != 0 && (*pte & (PTE_V | PTE_SWAP)))
+                continue;
+            if (vmaload(mm, v, a, PTE_R) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// Give nmm copies of mm's regions, as fork() does.
+// Pages of the regions that lie above mm->sz are not copied by
+// uvmcopy(), so share them here: copy-on-write for private
+// regions, writable in both for MAP_SHARED ones.
+// Returns 0 on success, -1 on failure.
+int vmacopy(struct mm* nmm, struct mm* mm) {
+    uint64 sz = PGROUNDUP(mm->sz), start;
+    struct vma* v;
+    int i;
+
+    for (i = 0; i < NVMA; i++) {
+        v = &mm->vmas[i];
+        start = v->start > sz ? v->start : sz;
+        if (v->end > start && uvmcopyrange(mm->pagetable, nmm->pagetable, start, v->end, v->flags & MAP_SHARED) < 0)
+            goto bad;
+    }
+    for (i = 0; i < NVMA; i++) {
+        nmm->vmas[i] = mm->vmas[i];
+        if (mm->vmas[i].ip)
+            nmm->vmas[i].ip = idup(mm->vmas[i].ip);
+        if (mm->vmas[i].shm)
+            shmdup(mm->vmas[i].shm);
+    }
+    return 0;
+
+bad:
+    while (--i >= 0) {
+        v = &mm->vmas[i];
+        start = v->start > sz ? v->start : sz;
+        if (v->end > start)
+            uvmunmap(nmm->pagetable, start, (v->end - start) / PGSIZE, 1);
+    }
+    return -1;
+}
+
+// Drop all regions in vmas and the inode references they hold,
+// without touching any page table.
+// Like iput(), must be called inside a transaction.
+void vmafree(struct vma* vmas) {
+    struct vma* v;
+
+    for (v = vmas; v < &vmas[NVMA]; v++) {
+        if (v->ip)
+            iput(v->ip);
+        if (v->shm)
+            shmput(v->shm);
+        v->ip = 0;
+        v->shm = 0;
+        v->start = v->end = 0;
+    }
+}
+
+// Write the dirty pages of v in [start, end) back to its file,
+// a few blocks per transaction, as filewrite() does.
+// Never makes the file longer.
+static void writeback(struct mm* mm, struct vma* v, uint64 start, uint64 end) {
+    int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
+    uint64 a, pa;
+    uint off, n, i;
+    pte_t* pte;
+
+    for (a = start; a < end; a += PGSIZE) {
+        pte = walk(mm->pagetable, a, 0);
+        if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_D) == 0)
+            continue;
+        pa = PTE2PA(*pte);
+        off = v->off + (a - v->start);
+        for (i = 0; i < PGSIZE; i += n) {
+            n = PGSIZE - i;
+            if (n > max)
+                n = max;
+            begin_op();
+            ilock(v->ip);
+            if (off + i >= v->ip->size)
+                n = PGSIZE - i;
+            else {
+                if (n > v->ip->size - (off + i))
+                    n = v->ip->size - (off + i);
+                writei(v->ip, 0, pa + i, off + i, n);
+            }
+            iunlock(v->ip);
+            end_op();
+        }
+    }
+}
+
+// Advance the start of region v to a, dropping the part below it.
+static void trim(struct vma* v, uint64 a) {
+    uint64 d = a - v->start;
+
+    v->off += d;
+    v->filesz = v->filesz > d ? v->filesz - d : 0;
+    v->start = a;
+}
+
+// Remove [va, va+len) from mm's regions, writing MAP_SHARED
+// pages back to their file and freeing the pages.
+// va must be page-aligned.  Must not be called inside a
+// transaction.
+// Returns 0 on success, -1 if a region would have to be split
+// in two and there is no free slot for the second half.
+int vmaunmap(struct mm* mm, uint64 va, uint64 len) {
+    uint64 s, e, end = PGROUNDUP(va + len);
+    struct vma *v, *w = 0;
+
+    if (end < va || mmlock(mm) < 0)
+        return -1;
+    for (v = mm->vmas; v < &mm->vmas[NVMA]; v++) {
+        if (v->end == 0)
+            w = v;
+    }
+    for (v = mm->vmas; v < &mm->vmas[NVMA]; v++) {
+        if (v->start < va && end < v->end && w == 0) {
+            mmunlock(mm);
+            return -1;
+        }
+    }
+
+    for (v = mm->vmas; v < &mm->vmas[NVMA]; v++) {
+        if (end <= v->start || va >= v->end)
+            continue;
+        s = va > v->start ? va : v->start;
+        e = end < v->end ? end : v->end;
+        if ((v->flags & MAP_SHARED) && v->ip)
+            writeback(mm, v, s, e);
+        uvmunmap(mm->pagetable, s, (e - s) / PGSIZE, 1);
+
+        if (s == v->start && e == v->end) {
+            if (v->ip) {
+                begin_op();
+                iput(v->ip);
+                end_op();
+            }
+            if (v->shm)
+                shmput(v->shm);
+            v->ip = 0;
+            v->shm = 0;
+            v->start = v->end = 0;
+        } else if (s == v->start) {
+            trim(v, e);
+        } else if (e == v->end) {
+            v->end = s;
+        } else {
+            //! 从中间挖掉一段, 后半段放到空闲的槽里
+            *w = *v;
+            if (w->ip)
+                w->ip = idup(w->ip);
+            if (w->shm)
+                shmdup(w->shm);
+            trim(w, e);
+            v->end = s;
+        }
+    }
+    mmunlock(mm);
+    return 0;
+}
+
+// Does any region of mm overlap [start, end)?
+int vmaoverlap(struct mm* mm, uint64 start, uint64 end) {
+    struct vma* v;
+
+    for (v = mm->vmas; v < &mm->vmas[NVMA]; v++) {
+        if (v->start < end && v->end > start)
+            return 1;
+    }
+    return 0;
+}
+
+// The highest address the heap of mm may grow to: the lowest
+// region above it, or MMAPTOP.
+uint64 vmalimit(struct mm* mm) {
+    uint64 sz = PGROUNDUP(mm->sz), lim = MMAPTOP;
+    struct vma* v;
+
+    for (v = mm->vmas; v < &mm->vmas[NVMA]; v++) {
+        if (v->end != 0 && v->start >= sz && v->start < lim)
+            lim = v->start;
+    }
+    return lim;
+}
+
+// Find a gap of len bytes for a new mapping in mm, as high
+// as possible below MMAPTOP and above the heap.
+// Returns its address, or 0 if there is none.
+static uint64 place(struct mm* mm, uint64 len) {
+    uint64 end = MMAPTOP;
+    struct vma* v;
+
+again:
+    if (end < len || end - len < PGROUNDUP(mm->sz))
+        return 0;
+    for (v = mm->vmas; v < &mm->vmas[NVMA]; v++) {
+        if (v->start < end && v->end > end - len) {
+            end = v->start;
+            goto again;
+        }
+    }
+    return end - len;
+}
+
+// Take a free region of mm for a new mapping of len bytes,
+// which must be page-aligned, and give it an address.
+// Returns the region, or 0 if mm has no free region or
+// no room for the mapping.  Caller must hold mmlock().
+static struct vma* vmanew(struct mm* mm, uint64 len) {
+    struct vma* v;
+    uint64 va;
+
+    for (v = mm->vmas; v < &mm->vmas[NVMA]; v++) {
+        if (v->end == 0)
+            break;
+    }
+    if (v == &mm->vmas[NVMA] || (va = place(mm, len)) == 0)
+        return 0;
+    memset(v, 0, sizeof(*v));
+    v->start = va;
+    v->end = va + len;
+    return v;
+}
+
+// Map len bytes of file f, starting at offset off, or of
+// zeroed memory if f is 0 (MAP_ANONYMOUS), into the current
+// process.  Pages are filled in when they are first touched.
+// Returns the address of the mapping, or -1.
+uint64 vmammap(uint64 len, int prot, int flags, struct file* f, uint off) {
+    struct mm* mm = myproc()->mm;
+    struct vma* w;
+    int type;
+
+    if (len == 0 || len > MMAPTOP || off % PGSIZE != 0)
+        return -1;
+    //! MAP_SHARED 和 MAP_PRIVATE 必须恰好给一个
+    if (((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+        return -1;
+    if (f) {
+        if (f->type != FD_INODE || !f->readable)
+            return -1;
+        //! 共享的可写映射最终要写回文件
+        if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+            return -1;
+        ilock(f->ip);
+        type = f->ip->type;
+        iunlock(f->ip);
+        if (type != T_FILE)
+            return -1;
+    }
+
+    if (mmlock(mm) < 0)
+        return -1;
+    if ((w = vmanew(mm, PGROUNDUP(len))) == 0) {
+        mmunlock(mm);
+        return -1;
+    }
+
+    //! PROT_READ/WRITE/EXEC 左移一位正好是 PTE_R/W/X
+    //! RISC-V 不允许只写不读的页
+    w->perm = PTE_U | (prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) << 1;
+    if (prot & PROT_WRITE)
+        w->perm |= PTE_R;
+    w->flags = flags;
+    w->ip = f ? idup(f->ip) : 0;
+    w->off = off;
+    w->filesz = f ? PGROUNDUP(len) : 0;
+    mmunlock(mm);
+    return w->start;
+}
+
+// Map len bytes of shared memory object s into the current
+// process, readable and writable.  The region takes over a
+// reference to s that the caller holds.
+// Returns the address of the mapping, or -1.
+uint64 vmashm(struct shm* s, uint64 len) {
+    struct mm* mm = myproc()->mm;
+    struct vma* w;
+
+    if (mmlock(mm) < 0)
+        return -1;
+    if ((w = vmanew(mm, len)) == 0) {
+        mmunlock(mm);
+        return -1;
+    }
+    w->perm = PTE_U | PTE_R | PTE_W;
+    w->flags = MAP_SHARED;
+    w->shm = s;
+    mmunlock(mm);
+    return w->start;
+}
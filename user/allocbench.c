@@ -0,0 +1,77 @@
+//
+// stress the kernel page allocator from several processes at
+// once and report how many pages per tick get allocated and
+// freed.  run with CPUS=1, 2, 4, ... to see how kalloc() scales.
+//
+// usage: allocbench [rounds]
+//
+
+#include "kernel/riscv.h"
+#include "kernel/stat.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NPAGES 64  // pages grown and shrunk per round
+
+void worker(int rounds) {
+    char* p;
+
+    for (int r = 0; r < rounds; r++) {
+        p = sbrk(NPAGES * PGSIZE);
+        if (p == (char*)-1) {
+            printf("allocbench: sbrk failed\n");
+            exit(1);
+        }
+        // touch every page, in case the kernel allocates lazily.
+        for (int i = 0; i < NPAGES; i++)
+            p[i * PGSIZE] = r;
+        if (sbrk(-NPAGES * PGSIZE) == (char*)-1) {
+            printf("allocbench: sbrk shrink failed\n");
+            exit(1);
+        }
+    }
+    exit(0);
+}
+
+// run nproc workers in parallel; returns elapsed ticks.
+int run(int nproc, int rounds) {
+    int start, xstatus, failed = 0;
+
+    start = uptime();
+    for (int i = 0; i < nproc; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("allocbench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0)
+            worker(rounds);
+    }
+    for (int i = 0; i < nproc; i++) {
+        wait(&xstatus);
+        if (xstatus != 0)
+            failed = 1;
+    }
+    if (failed) {
+        printf("allocbench: a worker failed\n");
+        exit(1);
+    }
+    return uptime() - start;
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = 200;
+
+    if (argc > 1)
+        rounds = atoi(argv[1]);
+
+    printf("allocbench: %d rounds of %d pages per process\n", rounds, NPAGES);
+    for (int nproc = 1; nproc <= 8; nproc *= 2) {
+        int t = run(nproc, rounds);
+        int pages = nproc * rounds * NPAGES;
+        if (t == 0)
+            t = 1;
+        printf("allocbench: %d procs: %d pages in %d ticks, %d pages/tick\n", nproc, pages, t, pages / t);
+    }
+    exit(0);
+}
@@ -0,0 +1,57 @@
+//
+// time fork+exec from a parent with a large heap.
+// with an eager fork the cost grows with the heap,
+// since fork copies every page that exec then throws away.
+//
+// usage: cowbench [iterations]
+//
+
+#include "kernel/riscv.h"
+#include "kernel/stat.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+// run n fork+exec+wait cycles; return elapsed ticks.
+int forkexec(int n) {
+    char* argv[] = {"cowbench", "-child", 0};
+    int start = uptime();
+
+    for (int i = 0; i < n; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("cowbench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            exec("cowbench", argv);
+            printf("cowbench: exec failed\n");
+            exit(1);
+        }
+        wait(0);
+    }
+    return uptime() - start;
+}
+
+int main(int argc, char* argv[]) {
+    int n = 100, mb = 0;
+
+    if (argc > 1 && strcmp(argv[1], "-child") == 0)
+        exit(0);
+    if (argc > 1)
+        n = atoi(argv[1]);
+
+    for (int heap = 0; heap <= 32; heap = heap ? heap * 2 : 2) {
+        // grow the heap to heap MB and touch every page.
+        char* p = sbrk((heap - mb) * 1024 * 1024);
+        if (p == (char*)-1) {
+            printf("cowbench: sbrk %d MB failed\n", heap);
+            exit(1);
+        }
+        for (int i = 0; i < (heap - mb) * 1024 * 1024; i += PGSIZE)
+            p[i] = 1;
+        mb = heap;
+        int t = forkexec(n);
+        printf("cowbench: heap %d MB: %d fork+exec in %d ticks\n", heap, n, t);
+    }
+    exit(0);
+}
@@ -0,0 +1,97 @@
+//
+// wakeup-to-run latency of an interactive process under CPU
+// load.  the interactive process sleeps for a millisecond at
+// a time; all it waits beyond that is time it spent runnable
+// behind the spinners.  build with
+// and without SCHED_MLFQ=1 and compare; the last run also
+// puts the spinners at the lowest priority.
+//
+// usage: latbench [nspinners [nsleeps]]
+//
+
+#include "kernel/param.h"
+#include "kernel/stat.h"
+#include "kernel/time.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define MAXSPIN (NPROC / 2)
+
+// spin until killed.
+void spinner(void) {
+    volatile int x = 0;
+
+    for (;;)
+        x++;
+}
+
+// start n spinners at priority prio; their pids go in pids.
+void start(int* pids, int n, int prio) {
+    for (int i = 0; i < n; i++) {
+        if ((pids[i] = fork()) < 0) {
+            printf("latbench: fork failed\n");
+            exit(1);
+        }
+        if (pids[i] == 0)
+            spinner();
+        setpriority(pids[i], prio);
+    }
+}
+
+void stop(int* pids, int n) {
+    for (int i = 0; i < n; i++)
+        kill(pids[i]);
+    for (int i = 0; i < n; i++)
+        wait(0);
+}
+
+#define SLEEPNS 1000000  // each sleep, in nanoseconds
+
+uint64 now(void) {
+    struct timespec ts;
+
+    uclock_gettime(&ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+// sleep nsleeps times and report the microseconds waited
+// beyond the asked-for time.
+void measure(char* what, int nsleeps) {
+    struct timespec ts = {0, SLEEPNS};
+    uint64 t, late;
+
+    t = now();
+    for (int i = 0; i < nsleeps; i++)
+        nanosleep(&ts);
+    t = now() - t;
+    late = (t - (uint64)nsleeps * SLEEPNS) / 1000;
+    printf("latbench: %s: %d sleeps in %d us, %d us late", what, nsleeps, (int)(t / 1000), (int)late);
+    printf(" (%d per wakeup)\n", (int)(late / nsleeps));
+}
+
+int main(int argc, char* argv[]) {
+    int n = 4, nsleeps = 50;
+    int pids[MAXSPIN];
+
+    if (argc > 1)
+        n = atoi(argv[1]);
+    if (argc > 2)
+        nsleeps = atoi(argv[2]);
+    if (n < 0 || n > MAXSPIN || nsleeps <= 0) {
+        printf("usage: latbench [nspinners [nsleeps]]\n");
+        exit(1);
+    }
+
+    measure("idle", nsleeps);
+
+    start(pids, n, 0);
+    sleep(10);  // let the spinners use up their time slices
+    measure("spinners", nsleeps);
+    stop(pids, n);
+
+    start(pids, n, NPRIO - 1);
+    measure("low-priority spinners", nsleeps);
+    stop(pids, n);
+
+    exit(0);
+}
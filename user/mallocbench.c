@@ -0,0 +1,81 @@
+//
+// time malloc() and free() on small objects, on a random mix
+// of small and large ones, and report how much of the heap is
+// left once everything is freed.
+//
+// usage: mallocbench [rounds]
+//
+
+#include "kernel/stat.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NPTR 512  // live objects at a time
+
+char* ptrs[NPTR];
+uint seed = 1;
+
+uint rnd(void) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+void* xmalloc(uint n) {
+    void* p = malloc(n);
+    if (p == 0) {
+        printf("mallocbench: malloc(%d) failed\n", n);
+        exit(1);
+    }
+    return p;
+}
+
+// allocate and free fixed-size small objects, NPTR at a time.
+int small(int rounds, uint size) {
+    int start = uptime();
+
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < NPTR; i++)
+            ptrs[i] = xmalloc(size);
+        for (int i = 0; i < NPTR; i++)
+            free(ptrs[i]);
+    }
+    return uptime() - start;
+}
+
+// replace random objects with new ones of random sizes,
+// one in eight of them large.
+int mixed(int rounds) {
+    int start = uptime();
+    uint n;
+
+    for (int r = 0; r < rounds * NPTR; r++) {
+        int i = rnd() % NPTR;
+        free(ptrs[i]);
+        n = rnd() % 8 == 0 ? 512 + rnd() * 2 : 1 + rnd() % 512;
+        ptrs[i] = xmalloc(n);
+        ptrs[i][0] = ptrs[i][n - 1] = 1;
+    }
+    for (int i = 0; i < NPTR; i++) {
+        free(ptrs[i]);
+        ptrs[i] = 0;
+    }
+    return uptime() - start;
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = 200, t, ops;
+    char* brk0 = sbrk(0);
+
+    if (argc > 1)
+        rounds = atoi(argv[1]);
+
+    ops = rounds * NPTR;
+    for (uint size = 16; size <= 512; size *= 2) {
+        t = small(rounds, size);
+        printf("mallocbench: %d x malloc+free of %d bytes in %d ticks\n", ops, size, t);
+    }
+    t = mixed(rounds);
+    printf("mallocbench: %d random malloc+free in %d ticks\n", ops, t);
+    printf("mallocbench: heap is %d bytes bigger after freeing everything\n", (int)(sbrk(0) - brk0));
+    exit(0);
+}
@@ -0,0 +1,60 @@
+//
+// print free physical memory and how it is split up
+// among the buddy allocator's block sizes.
+//
+// usage: memstat [interval]
+// with an interval, print again every interval ticks.
+//
+
+#include "kernel/memstat.h"
+#include "kernel/param.h"
+#include "kernel/stat.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+void print(void) {
+    struct memstat st;
+    uint64 big = 0;
+    int largest = -1;
+
+    if (memstat(&st) < 0) {
+        fprintf(2, "memstat: failed\n");
+        exit(1);
+    }
+
+    printf("free %d pages (%d KB), %d cached on harts, %d zeroed\n", (int)st.freepages,
+           (int)st.freepages * 4, (int)st.cachedpages, (int)st.zeropages);
+    printf("order  blocks  pages\n");
+    for (int k = 0; k <= MAXORDER; k++) {
+        printf("%d\t%d\t%d\n", k, (int)st.nfree[k], (int)(st.nfree[k] << k));
+        if (st.nfree[k])
+            largest = k;
+        if (k >= 9)
+            big += st.nfree[k] << k;
+    }
+
+    printf("swap: %d of %d slots used, %d pages in, %d out\n", (int)st.swapused,
+           (int)(st.swapused + st.swapfree), (int)st.swapins, (int)st.swapouts);
+
+    // how much of the free memory could not back a 2 MB
+    // (order 9) allocation: 0% means none is fragmented.
+    printf("largest free block: order %d\n", largest);
+    if (st.freepages)
+        printf("fragmentation: %d%% of free pages are in blocks below order 9\n",
+               (int)(100 - big * 100 / st.freepages));
+}
+
+int main(int argc, char* argv[]) {
+    int interval = 0;
+
+    if (argc > 1)
+        interval = atoi(argv[1]);
+
+    print();
+    while (interval > 0) {
+        sleep(interval);
+        printf("\n");
+        print();
+    }
+    exit(0);
+}
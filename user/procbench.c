@@ -0,0 +1,109 @@
+//
+// fork()/exit()/wait() and kill() throughput with many
+// processes around.  a helper starts idle processes that
+// sleep in read() on a pipe, so that the process table fills
+// up without them being our children, then times forking a
+// child that exits at once and waiting for it, and forking a
+// child that sleeps, killing it and waiting for it.  raise
+// NPROC in kernel/param.h to see these not depend on it.
+//
+// usage: procbench [nidle [rounds]]
+//
+
+#include "kernel/stat.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+void fail(char* what) {
+    printf("procbench: %s failed\n", what);
+    exit(1);
+}
+
+// fork, exit and wait rounds times; returns elapsed ticks.
+int forkexit(int rounds) {
+    int start = uptime(), pid;
+
+    for (int i = 0; i < rounds; i++) {
+        if ((pid = fork()) < 0)
+            fail("fork");
+        if (pid == 0)
+            exit(0);
+        if (wait(0) != pid)
+            fail("wait");
+    }
+    return uptime() - start;
+}
+
+// fork a child that sleeps, kill it and wait for it, rounds
+// times; returns elapsed ticks.
+int forkkill(int rounds) {
+    int start = uptime(), pid;
+
+    for (int i = 0; i < rounds; i++) {
+        if ((pid = fork()) < 0)
+            fail("fork");
+        if (pid == 0) {
+            for (;;)
+                sleep(1000);
+        }
+        if (kill(pid) < 0)
+            fail("kill");
+        if (wait(0) != pid)
+            fail("wait");
+    }
+    return uptime() - start;
+}
+
+void report(char* what, int ops, int t) {
+    printf("procbench: %s: %d in %d ticks", what, ops, t);
+    if (t > 0)
+        printf(", %d/tick", ops / t);
+    printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+    int nidle = 40, rounds = 1000, idle[2], ready[2], helper, n;
+    char c;
+
+    if (argc > 1)
+        nidle = atoi(argv[1]);
+    if (argc > 2)
+        rounds = atoi(argv[2]);
+
+    // the helper's children sleep until the idle pipe is
+    // closed; the helper reports how many it started.
+    if (pipe(idle) < 0 || pipe(ready) < 0)
+        fail("pipe");
+    if ((helper = fork()) < 0)
+        fail("fork");
+    if (helper == 0) {
+        close(idle[1]);
+        close(ready[0]);
+        for (n = 0; n < nidle; n++) {
+            int pid = fork();
+            if (pid < 0)
+                break;
+            if (pid == 0) {
+                read(idle[0], &c, 1);
+                exit(0);
+            }
+        }
+        write(ready[1], &n, sizeof(n));
+        while (n-- > 0)
+            wait(0);
+        exit(0);
+    }
+    close(idle[0]);
+    close(ready[1]);
+    if (read(ready[0], &n, sizeof(n)) != sizeof(n))
+        fail("helper");
+    close(ready[0]);
+    printf("procbench: %d idle processes\n", n);
+
+    report("fork/exit/wait", rounds, forkexit(rounds));
+    report("fork/kill/wait", rounds, forkkill(rounds));
+
+    close(idle[1]);
+    wait(0);
+    exit(0);
+}
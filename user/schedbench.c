@@ -0,0 +1,93 @@
+//
+// scheduling overhead.  pairs of processes bounce a byte over
+// two pipes, so every round trip is two sleeps, two wakeups
+// and two context switches; then compute-bound processes
+// share the harts.  run with CPUS=1, 2, 4, 8 to see how the
+// scheduler scales.
+//
+// usage: schedbench [rounds]
+//
+
+#include "kernel/stat.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+void fail(char* what) {
+    printf("schedbench: %s failed\n", what);
+    exit(1);
+}
+
+// bounce a byte between two processes rounds times.
+void pingpong(int rounds) {
+    int a[2], b[2], pid;
+    char c = 0;
+
+    if (pipe(a) < 0 || pipe(b) < 0)
+        fail("pipe");
+    if ((pid = fork()) < 0)
+        fail("fork");
+    if (pid == 0) {
+        for (int i = 0; i < rounds; i++) {
+            if (read(a[0], &c, 1) != 1 || write(b[1], &c, 1) != 1)
+                fail("child pipe");
+        }
+        exit(0);
+    }
+    for (int i = 0; i < rounds; i++) {
+        if (write(a[1], &c, 1) != 1 || read(b[0], &c, 1) != 1)
+            fail("parent pipe");
+    }
+    wait(0);
+    exit(0);
+}
+
+// spin for a while without system calls.
+void spin(int rounds) {
+    volatile int x = 0;
+
+    for (int i = 0; i < rounds * 10000; i++)
+        x++;
+    exit(0);
+}
+
+// run n copies of f in parallel; returns elapsed ticks.
+int run(void (*f)(int), int n, int rounds) {
+    int start, xstatus, failed = 0;
+
+    start = uptime();
+    for (int i = 0; i < n; i++) {
+        int pid = fork();
+        if (pid < 0)
+            fail("fork");
+        if (pid == 0)
+            f(rounds);
+    }
+    for (int i = 0; i < n; i++) {
+        wait(&xstatus);
+        if (xstatus != 0)
+            failed = 1;
+    }
+    if (failed)
+        fail("a worker");
+    return uptime() - start;
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = 2000, t;
+
+    if (argc > 1)
+        rounds = atoi(argv[1]);
+
+    for (int n = 1; n <= 8; n *= 2) {
+        t = run(pingpong, n, rounds);
+        printf("schedbench: %d pairs: %d round trips in %d ticks", n, n * rounds, t);
+        if (t > 0)
+            printf(", %d/tick", n * rounds / t);
+        printf("\n");
+    }
+    for (int n = 1; n <= 16; n *= 2) {
+        t = run(spin, n, rounds);
+        printf("schedbench: %d spinners: %d ticks\n", n, t);
+    }
+    exit(0);
+}
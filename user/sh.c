@@ -12,6 +12,7 @@
 #define BACK 5
 
 #define MAXARGS 10
+#define MAXACTS 16  // spawn() file actions per command
 
 struct cmd {
     int type;
@@ -52,7 +53,10 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd* parsecmd(char*);
+void freecmd(struct cmd*);
 void runcmd(struct cmd*) __attribute__((noreturn));
+int spawnable(struct cmd*);
+void runspawn(struct cmd*);
 
 // Execute cmd.  Never returns.
 void runcmd(struct cmd* cmd) {
@@ -140,6 +144,7 @@ int getcmd(char* buf, int nbuf) {
 
 int main(void) {
     static char buf[100];
+    struct cmd* cmd;
     int fd;
 
     // Ensure that three file descriptors are open.
@@ -159,13 +164,110 @@ int main(void) {
                 fprintf(2, "cannot cd %s\n", buf + 3);
             continue;
         }
-        if (fork1() == 0)
-            runcmd(parsecmd(buf));
-        wait(0);
+        if ((cmd = parsecmd(buf)) == 0)
+            continue;
+        if (spawnable(cmd)) {
+            // no need to fork a copy of the shell.
+            runspawn(cmd);
+        } else {
+            if (fork1() == 0)
+                runcmd(cmd);
+            wait(0);
+        }
+        freecmd(cmd);
     }
     exit(0);
 }
 
+// Is cmd a program with redirections, which spawn1() can run?
+int simple(struct cmd* cmd) {
+    while (cmd->type == REDIR)
+        cmd = ((struct redircmd*)cmd)->cmd;
+    return cmd->type == EXEC && ((struct execcmd*)cmd)->argv[0] != 0;
+}
+
+// Can runspawn() run cmd: a pipeline of simple commands?
+int spawnable(struct cmd* cmd) {
+    while (cmd->type == PIPE) {
+        if (!simple(((struct pipecmd*)cmd)->left))
+            return 0;
+        cmd = ((struct pipecmd*)cmd)->right;
+    }
+    return simple(cmd);
+}
+
+// Start the simple command cmd with spawn(), with its standard
+// input and output connected to in and out, and other (if not
+// -1) closed.  Returns its pid, or -1.
+int spawn1(struct cmd* cmd, int in, int out, int other) {
+    struct spawnact acts[MAXACTS + 1];
+    struct redircmd* rcmd;
+    struct execcmd* ecmd;
+    int fds[MAXACTS], nfd = 0, n = 0, fd, pid = -1;
+
+    if (in != 0) {
+        acts[n++] = (struct spawnact){SPAWN_DUP2, in, 0};
+        acts[n++] = (struct spawnact){SPAWN_CLOSE, in, 0};
+    }
+    if (out != 1) {
+        acts[n++] = (struct spawnact){SPAWN_DUP2, out, 1};
+        acts[n++] = (struct spawnact){SPAWN_CLOSE, out, 0};
+    }
+    if (other >= 0)
+        acts[n++] = (struct spawnact){SPAWN_CLOSE, other, 0};
+
+    // the shell opens the files; the child gets them in
+    // place of the redirected descriptors.
+    for (; cmd->type == REDIR; cmd = rcmd->cmd) {
+        rcmd = (struct redircmd*)cmd;
+        if (n + 2 > MAXACTS) {
+            fprintf(2, "too many redirections\n");
+            goto out;
+        }
+        if ((fd = open(rcmd->file, rcmd->mode)) < 0) {
+            fprintf(2, "open %s failed\n", rcmd->file);
+            goto out;
+        }
+        fds[nfd++] = fd;
+        acts[n++] = (struct spawnact){SPAWN_DUP2, fd, rcmd->fd};
+        acts[n++] = (struct spawnact){SPAWN_CLOSE, fd, 0};
+    }
+    acts[n].op = 0;
+
+    ecmd = (struct execcmd*)cmd;
+    if ((pid = spawn(ecmd->argv[0], ecmd->argv, acts)) < 0)
+        fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+out:
+    while (nfd > 0)
+        close(fds[--nfd]);
+    return pid;
+}
+
+// Run a pipeline of simple commands with spawn(), and wait
+// for all of its stages.
+void runspawn(struct cmd* cmd) {
+    struct pipecmd* pcmd;
+    int p[2], in = 0, n = 0;
+
+    for (; cmd->type == PIPE; cmd = pcmd->right) {
+        pcmd = (struct pipecmd*)cmd;
+        if (pipe(p) < 0)
+            panic("pipe");
+        if (spawn1(pcmd->left, in, p[1], p[0]) >= 0)
+            n++;
+        if (in != 0)
+            close(in);
+        close(p[1]);
+        in = p[0];
+    }
+    if (spawn1(cmd, in, 1, -1) >= 0)
+        n++;
+    if (in != 0)
+        close(in);
+    while (n-- > 0)
+        wait(0);
+}
+
 void panic(char* s) {
     fprintf(2, "%s\n", s);
     exit(1);
@@ -237,6 +339,30 @@ struct cmd* backcmd(struct cmd* subcmd) {
     cmd->cmd = subcmd;
     return (struct cmd*)cmd;
 }
+
+// Free a parsed command.  The shell parses every line itself
+// now, so it must give the memory back.
+void freecmd(struct cmd* cmd) {
+    if (cmd == 0)
+        return;
+    switch (cmd->type) {
+        case REDIR:
+            freecmd(((struct redircmd*)cmd)->cmd);
+            break;
+        case PIPE:
+            freecmd(((struct pipecmd*)cmd)->left);
+            freecmd(((struct pipecmd*)cmd)->right);
+            break;
+        case LIST:
+            freecmd(((struct listcmd*)cmd)->left);
+            freecmd(((struct listcmd*)cmd)->right);
+            break;
+        case BACK:
+            freecmd(((struct backcmd*)cmd)->cmd);
+            break;
+    }
+    free(cmd);
+}
 // PAGEBREAK!
 //  Parsing
 
@@ -301,16 +427,32 @@ struct cmd* parsepipe(char**, char*);
 struct cmd* parseexec(char**, char*);
 struct cmd* nulterminate(struct cmd*);
 
+// set by syntax(); the shell parses in its own process, so
+// a mistake in a line must not make it exit.
+int parseerr;
+
+void syntax(char* s) {
+    if (!parseerr)
+        fprintf(2, "%s\n", s);
+    parseerr = 1;
+}
+
+// Parse a command line.  Returns 0 if it has a syntax error.
 struct cmd* parsecmd(char* s) {
     char* es;
     struct cmd* cmd;
 
+    parseerr = 0;
     es = s + strlen(s);
     cmd = parseline(&s, es);
     peek(&s, es, "");
     if (s != es) {
         fprintf(2, "leftovers: %s\n", s);
-        panic("syntax");
+        syntax("syntax");
+    }
+    if (parseerr) {
+        freecmd(cmd);
+        return 0;
     }
     nulterminate(cmd);
     return cmd;
@@ -348,8 +490,10 @@ struct cmd* parseredirs(struct cmd* cmd, char** ps, char* es) {
 
     while (peek(ps, es, "<>")) {
         tok = gettoken(ps, es, 0, 0);
-        if (gettoken(ps, es, &q, &eq) != 'a')
-            panic("missing file for redirection");
+        if (gettoken(ps, es, &q, &eq) != 'a') {
+            syntax("missing file for redirection");
+            break;
+        }
         switch (tok) {
             case '<':
                 cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -372,8 +516,10 @@ struct cmd* parseblock(char** ps, char* es) {
         panic("parseblock");
     gettoken(ps, es, 0, 0);
     cmd = parseline(ps, es);
-    if (!peek(ps, es, ")"))
-        panic("syntax - missing )");
+    if (!peek(ps, es, ")")) {
+        syntax("syntax - missing )");
+        return cmd;
+    }
     gettoken(ps, es, 0, 0);
     cmd = parseredirs(cmd, ps, es);
     return cmd;
@@ -396,13 +542,17 @@ struct cmd* parseexec(char** ps, char* es) {
     while (!peek(ps, es, "|)&;")) {
         if ((tok = gettoken(ps, es, &q, &eq)) == 0)
             break;
-        if (tok != 'a')
-            panic("syntax");
+        if (tok != 'a') {
+            syntax("syntax");
+            break;
+        }
+        if (argc + 1 >= MAXARGS) {
+            syntax("too many args");
+            break;
+        }
         cmd->argv[argc] = q;
         cmd->eargv[argc] = eq;
         argc++;
-        if (argc >= MAXARGS)
-            panic("too many args");
         ret = parseredirs(ret, ps, es);
     }
     cmd->argv[argc] = 0;
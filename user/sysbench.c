@@ -0,0 +1,52 @@
+//
+// system call latency.  does many getpid() calls, first back to
+// back and then each followed by touching a few pages, and
+// reports the time per call.  with ASIDs, the pages' TLB entries
+// survive the trip into the kernel and back; without them, the
+// trampoline flushes the TLB and every touch misses.
+//
+// usage: sysbench [calls [pages]]
+//
+
+#include "kernel/riscv.h"
+#include "kernel/stat.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+// time n calls, each followed by touching npages pages of p.
+void run(char* what, int n, char* p, int npages) {
+    int t;
+
+    t = uptime();
+    for (int i = 0; i < n; i++) {
+        getpid();
+        for (int j = 0; j < npages; j++)
+            p[j * PGSIZE]++;
+    }
+    t = uptime() - t;
+    printf("sysbench: %s: %d calls in %d ticks", what, n, t);
+    if (t > 0)
+        printf(", %d calls/tick", n / t);
+    printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+    int n = 200000, npages = 32;
+    char* p;
+
+    if (argc > 1)
+        n = atoi(argv[1]);
+    if (argc > 2)
+        npages = atoi(argv[2]);
+
+    if ((p = sbrk(npages * PGSIZE)) == (char*)-1) {
+        printf("sysbench: sbrk failed\n");
+        exit(1);
+    }
+    for (int j = 0; j < npages; j++)
+        p[j * PGSIZE] = 0;
+
+    run("getpid", n, p, 0);
+    run("getpid + touch", n, p, npages);
+    exit(0);
+}
@@ -0,0 +1,78 @@
+//
+// random reads and writes all over a big heap, so that almost
+// every access misses the TLB.  the heap is set up twice: once
+// grown a page at a time and touched as it grows, which leaves
+// it in 4 KB pages, and once grown in one sbrk() and touched
+// afterwards, which lets the kernel back it with 2 MB pages.
+//
+// usage: thpbench [mb [accesses]]
+//
+
+#include "kernel/riscv.h"
+#include "kernel/stat.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+// set up an mb megabyte heap, do n random accesses to it,
+// and report the ticks they took.
+void run(char* what, int mb, int n, int small) {
+    uint64 size = (uint64)mb * 1024 * 1024;
+    uint32 x = 1;
+    int faults, t;
+    char* p;
+
+    faults = pgfaults();
+    // start the heap on a 2 MB boundary.
+    sbrk(MEGAROUNDUP((uint64)sbrk(0)) - (uint64)sbrk(0));
+    if (small) {
+        p = sbrk(0);
+        for (uint64 i = 0; i < size; i += PGSIZE) {
+            if (sbrk(PGSIZE) == (char*)-1) {
+                printf("thpbench: sbrk failed\n");
+                exit(1);
+            }
+            p[i] = 1;
+        }
+    } else {
+        if ((p = sbrk(size)) == (char*)-1) {
+            printf("thpbench: sbrk failed\n");
+            exit(1);
+        }
+        for (uint64 i = 0; i < size; i += PGSIZE)
+            p[i] = 1;
+    }
+    faults = pgfaults() - faults;
+
+    t = uptime();
+    for (int i = 0; i < n; i++) {
+        x = x * 1664525 + 1013904223;
+        p[x % size] += 1;
+    }
+    t = uptime() - t;
+    printf("thpbench: %s: %d page faults to set up, %d accesses in %d ticks\n", what, faults, n, t);
+}
+
+int main(int argc, char* argv[]) {
+    int mb = 32, n = 20000000;
+
+    if (argc > 1)
+        mb = atoi(argv[1]);
+    if (argc > 2)
+        n = atoi(argv[2]);
+
+    printf("thpbench: %d MB heap\n", mb);
+    // each run in a child, so they start from the same heap.
+    for (int small = 1; small >= 0; small--) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("thpbench: fork failed\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            run(small ? "4 KB pages" : "2 MB pages", mb, n, small);
+            exit(0);
+        }
+        wait(0);
+    }
+    exit(0);
+}
@@ -1,6 +1,10 @@
 #include "kernel/fcntl.h"
+#include "kernel/memlayout.h"
+#include "kernel/riscv.h"
 #include "kernel/stat.h"
+#include "kernel/time.h"
 #include "kernel/types.h"
+#include "kernel/vdso.h"
 #include "user/user.h"
 
 //
@@ -121,3 +125,28 @@ int memcmp(const void* s1, const void* s2, uint n) {
 void* memcpy(void* dst, const void* src, uint n) {
     return memmove(dst, src, n);
 }
+
+// The kernel's read-only page with the time calibration and
+// the pids; the functions below read it, and the time CSR,
+// without a system call.
+static volatile struct vdso* const vdsop = (struct vdso*)VDSO;
+
+// getpid() without a system call.  The kernel keeps the
+// thread's proc slot in tp.
+int ugetpid(void) {
+    return vdsop->pid[r_tp()];
+}
+
+// uptime() without a system call.
+int uuptime(void) {
+    return r_time() / vdsop->tickcycles;
+}
+
+// clock_gettime(CLOCK_MONOTONIC, ts) without a system call.
+int uclock_gettime(struct timespec* ts) {
+    uint64 t = r_time(), f = vdsop->timefreq;
+
+    ts->tv_sec = t / f;
+    ts->tv_nsec = (t % f) * (NSEC_PER_SEC / f);
+    return 0;
+}
@@ -1,84 +1,386 @@
 #include "kernel/param.h"
+#include "kernel/riscv.h"
 #include "kernel/stat.h"
 #include "kernel/types.h"
 #include "user/user.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with size classes.
+//
+// Small requests (up to 512 bytes) come from slabs: blocks of
+// SLABSIZE bytes cut into objects of one size class, with a
+// free list in each slab.  Every class keeps a list of its
+// slabs that have free objects, so malloc() and free() of a
+// small object take constant time.  A slab whose objects are
+// all free is given back, unless it is its class's only one.
+//
+// Larger requests, and slabs, come from the large allocator.
+// Its blocks carry boundary tags: a header with the size and,
+// while the block is free, a footer with the size, so free()
+// merges a block with free neighbours at once.  Free blocks
+// sit in a binary tree ordered by size, blocks of the same
+// size in a ring at their tree node, and malloc() takes the
+// best fit.  The heap grows with sbrk(); when the free block
+// at its top gets big, free() gives most of it back with a
+// negative sbrk().
 
-typedef long Align;
+// Every block handed out is preceded by a tag word.  For a
+// block of the large allocator it holds the block's size (a
+// multiple of 8, tag included) and the flags below; for a
+// small object, the address of its slab with SMALL set.
+#define INUSE 1   // the block is allocated
+#define PINUSE 2  // the block before it is allocated
+#define SMALL 4   // a small object; the rest is its slab
+#define FLAGS 7
 
-union header {
-    struct {
-        union header* ptr;
-        uint size;
-    } s;
-    Align x;
+#define TAGSIZE sizeof(uint64)
+#define ROUND8(n) (((n) + 7) & ~(uint64)7)
+
+#define GROW (64 * 1024)   // least the heap grows by
+#define TRIM (256 * 1024)  // top free block size that is trimmed
+#define KEEP (64 * 1024)   // what trimming leaves of it
+
+// A free block of the large allocator.  The tree fields are
+// only used by the member of a ring that is in the tree.
+struct fblock {
+    uint64 tag;
+    struct fblock* next;  // ring of free blocks of this size
+    struct fblock* prev;
+    struct fblock* left;  // smaller sizes
+    struct fblock* right;  // larger sizes
+    struct fblock* parent;
+    int intree;
 };
 
-typedef union header Header;
+// least block size: a free block needs room for its fields
+// and the footer.
+#define MINBLOCK ROUND8(sizeof(struct fblock) + TAGSIZE)
 
-static Header base;
-static Header* freep;
+#define SIZE(b) ((b)->tag & ~(uint64)FLAGS)
 
-void free(void* ap) {
-    Header *bp, *p;
-
-    bp = (Header*)ap - 1;
-    for (p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-        if (p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-            break;
-    if (bp + bp->s.size == p->s.ptr) {
-        bp->s.size += p->s.ptr->s.size;
-        bp->s.ptr = p->s.ptr->s.ptr;
-    } else
-        bp->s.ptr = p->s.ptr;
-    if (p + p->s.size == bp) {
-        p->s.size += bp->s.size;
-        p->s.ptr = bp->s.ptr;
-    } else
-        p->s.ptr = bp;
-    freep = p;
-}
-
-static Header* morecore(uint nu) {
+static struct fblock* root;  // tree of free blocks
+static struct fblock* top;   // end marker of the newest heap region
+
+#define SLABSIZE 4096
+#define MAXSMALL 512
+#define NCLASS 10
+
+// A slab, after the tag of its large block.
+struct slab {
+    struct slab* next;  // class's slabs with free objects
+    struct slab* prev;
+    void* free;         // free objects, linked through their first word
+    int nfree;
+    int nobj;
+    int cls;
+};
+
+static struct {
+    uint size;            // bytes in an object, without its tag
+    struct slab* partial;  // slabs with free objects
+} classes[NCLASS] = {{16}, {32}, {48}, {64}, {96}, {128}, {192}, {256}, {384}, {512}};
+
+// class of a request of n bytes, indexed by (n+15)/16.
+static char classof[MAXSMALL / 16 + 1];
+
+static struct fblock* after(struct fblock* b) {
+    return (struct fblock*)((char*)b + SIZE(b));
+}
+
+static void setfoot(struct fblock* b) {
+    *(uint64*)((char*)b + SIZE(b) - TAGSIZE) = SIZE(b);
+}
+
+// The pointer in the tree that points to tree node b.
+static struct fblock** treelink(struct fblock* b) {
+    if (b->parent == 0)
+        return &root;
+    return b->parent->left == b ? &b->parent->left : &b->parent->right;
+}
+
+// Add free block b to the tree.
+static void insert(struct fblock* b) {
+    struct fblock **pp = &root, *parent = 0, *n;
+    uint64 sz = SIZE(b);
+
+    while ((n = *pp) != 0) {
+        if (SIZE(n) == sz) {
+            b->intree = 0;
+            b->next = n->next;
+            b->prev = n;
+            n->next->prev = b;
+            n->next = b;
+            return;
+        }
+        parent = n;
+        pp = sz < SIZE(n) ? &n->left : &n->right;
+    }
+    b->intree = 1;
+    b->left = b->right = 0;
+    b->parent = parent;
+    b->next = b->prev = b;
+    *pp = b;
+}
+
+// Take free block b out of the tree.
+static void delete(struct fblock* b) {
+    struct fblock *r, **pp;
+
+    if (b->next != b) {
+        b->prev->next = b->next;
+        b->next->prev = b->prev;
+        if (!b->intree)
+            return;
+        // another block of the same size takes b's place.
+        r = b->next;
+        *treelink(b) = r;
+        r->intree = 1;
+        r->parent = b->parent;
+        if ((r->left = b->left) != 0)
+            r->left->parent = r;
+        if ((r->right = b->right) != 0)
+            r->right->parent = r;
+        return;
+    }
+
+    pp = treelink(b);
+    if (b->left == 0 || b->right == 0) {
+        r = b->left ? b->left : b->right;
+        if (r)
+            r->parent = b->parent;
+    } else {
+        // the smallest node right of b takes its place.
+        for (r = b->right; r->left; r = r->left)
+            ;
+        if (r != b->right) {
+            if ((r->parent->left = r->right) != 0)
+                r->right->parent = r->parent;
+            r->right = b->right;
+            r->right->parent = r;
+        }
+        r->left = b->left;
+        r->left->parent = r;
+        r->parent = b->parent;
+    }
+    *pp = r;
+}
+
+// The smallest free block of at least sz bytes, or 0.
+static struct fblock* bestfit(uint64 sz) {
+    struct fblock *n = root, *best = 0;
+
+    while (n) {
+        if (SIZE(n) == sz)
+            return n;
+        if (SIZE(n) > sz) {
+            best = n;
+            n = n->left;
+        } else {
+            n = n->right;
+        }
+    }
+    return best;
+}
+
+// Turn allocated block b into a free one, merged with its
+// free neighbours, and return that; it is not in the tree.
+static struct fblock* merge(struct fblock* b) {
+    struct fblock *n, *p;
+    uint64 sz = SIZE(b);
+
+    n = after(b);
+    if ((n->tag & INUSE) == 0) {
+        delete(n);
+        sz += SIZE(n);
+    }
+    if ((b->tag & PINUSE) == 0) {
+        p = (struct fblock*)((char*)b - *((uint64*)b - 1));
+        delete(p);
+        sz += SIZE(p);
+        b = p;
+    }
+    // the block before a free block is always in use.
+    b->tag = sz | PINUSE;
+    setfoot(b);
+    after(b)->tag &= ~PINUSE;
+    return b;
+}
+
+// Grow the heap by at least sz bytes and put the new space in
+// the tree, merged with a free block at the old top.
+// Returns -1 if sbrk() fails.
+static int morecore(uint64 sz) {
+    uint64 n, pad;
+    struct fblock* b;
     char* p;
-    Header* hp;
 
-    if (nu < 4096)
-        nu = 4096;
-    p = sbrk(nu * sizeof(Header));
-    if (p == (char*)-1)
+    n = PGROUNDUP(sz + TAGSIZE);
+    if (n < GROW)
+        n = GROW;
+    p = sbrk(0);
+    pad = ROUND8((uint64)p) - (uint64)p;
+    if (n + pad > 0x7fffffff || (p = sbrk(n + pad)) == (char*)-1)
+        return -1;
+    if (top && p == (char*)top + TAGSIZE) {
+        // right after our heap: the old end marker becomes
+        // the new block's tag.
+        b = top;
+        b->tag = n | (b->tag & PINUSE);
+    } else {
+        // someone else moved the break; start a new region.
+        b = (struct fblock*)(p + pad);
+        b->tag = (n - TAGSIZE) | PINUSE;
+    }
+    top = after(b);
+    top->tag = INUSE;
+    insert(merge(b));
+    return 0;
+}
+
+// Give the free block b at the top of the heap back to the
+// kernel, but for KEEP bytes, if it is big and nobody moved
+// the break since the heap last grew.
+static void trim(struct fblock* b) {
+    uint64 n;
+
+    if (after(b) != top || SIZE(b) < TRIM || sbrk(0) != (char*)top + TAGSIZE)
+        return;
+    n = PGROUNDDOWN(SIZE(b) - KEEP);
+    if (n > 0x7ffff000)
+        n = 0x7ffff000;
+    delete(b);
+    b->tag -= n;
+    setfoot(b);
+    top = after(b);
+    top->tag = INUSE;
+    insert(b);
+    sbrk(-(int)n);
+}
+
+// Allocate a block of the large allocator with room for n
+// bytes after its tag.  Returns 0 if there is no memory.
+static struct fblock* bigalloc(uint64 n) {
+    uint64 sz = ROUND8(n + TAGSIZE);
+    struct fblock *b, *r;
+
+    if (sz < MINBLOCK)
+        sz = MINBLOCK;
+    if ((b = bestfit(sz)) == 0) {
+        if (morecore(sz) < 0 || (b = bestfit(sz)) == 0)
+            return 0;
+    }
+    // taking a ring member leaves the tree alone.
+    if (b->next != b)
+        b = b->next;
+    delete(b);
+    if (SIZE(b) - sz >= MINBLOCK) {
+        r = (struct fblock*)((char*)b + sz);
+        r->tag = (SIZE(b) - sz) | PINUSE;
+        setfoot(r);
+        insert(r);
+        b->tag = sz | (b->tag & PINUSE);
+    } else {
+        after(b)->tag |= PINUSE;
+    }
+    b->tag |= INUSE;
+    return b;
+}
+
+static void bigfree(struct fblock* b) {
+    b = merge(b);
+    insert(b);
+    trim(b);
+}
+
+// Make a new slab of class c and put it on the class's list.
+static struct slab* newslab(int c) {
+    struct fblock* b;
+    struct slab* s;
+    uint64 stride = TAGSIZE + classes[c].size;
+    char* o;
+
+    if ((b = bigalloc(SLABSIZE - TAGSIZE)) == 0)
         return 0;
-    hp = (Header*)p;
-    hp->s.size = nu;
-    free((void*)(hp + 1));
-    return freep;
+    s = (struct slab*)((char*)b + TAGSIZE);
+    s->cls = c;
+    s->free = 0;
+    s->nobj = 0;
+    for (o = (char*)s + ROUND8(sizeof(*s)); o + stride <= (char*)b + SIZE(b); o += stride) {
+        *(uint64*)o = (uint64)s | SMALL;
+        *(void**)(o + TAGSIZE) = s->free;
+        s->free = o + TAGSIZE;
+        s->nobj++;
+    }
+    s->nfree = s->nobj;
+    s->prev = 0;
+    s->next = 0;
+    classes[c].partial = s;
+    return s;
 }
 
-void* malloc(uint nbytes) {
-    Header *p, *prevp;
-    uint nunits;
+static void* smallalloc(int c) {
+    struct slab* s;
+    void* o;
+
+    if ((s = classes[c].partial) == 0 && (s = newslab(c)) == 0)
+        return 0;
+    o = s->free;
+    s->free = *(void**)o;
+    if (--s->nfree == 0) {
+        // full; s is at the head of the list.
+        if ((classes[c].partial = s->next) != 0)
+            s->next->prev = 0;
+    }
+    return o;
+}
 
-    nunits = (nbytes + sizeof(Header) - 1) / sizeof(Header) + 1;
-    if ((prevp = freep) == 0) {
-        base.s.ptr = freep = prevp = &base;
-        base.s.size = 0;
+static void smallfree(struct slab* s, void* o) {
+    struct slab** head = &classes[s->cls].partial;
+
+    *(void**)o = s->free;
+    s->free = o;
+    if (s->nfree++ == 0) {
+        s->prev = 0;
+        if ((s->next = *head) != 0)
+            s->next->prev = s;
+        *head = s;
+    } else if (s->nfree == s->nobj && (s->prev || s->next)) {
+        if (s->prev)
+            s->prev->next = s->next;
+        else
+            *head = s->next;
+        if (s->next)
+            s->next->prev = s->prev;
+        bigfree((struct fblock*)((char*)s - TAGSIZE));
     }
-    for (p = prevp->s.ptr;; prevp = p, p = p->s.ptr) {
-        if (p->s.size >= nunits) {
-            if (p->s.size == nunits)
-                prevp->s.ptr = p->s.ptr;
-            else {
-                p->s.size -= nunits;
-                p += p->s.size;
-                p->s.size = nunits;
+}
+
+void free(void* ap) {
+    uint64 tag;
+
+    if (ap == 0)
+        return;
+    tag = *((uint64*)ap - 1);
+    if (tag & SMALL)
+        smallfree((struct slab*)(tag & ~(uint64)FLAGS), ap);
+    else
+        bigfree((struct fblock*)((uint64*)ap - 1));
+}
+
+void* malloc(uint nbytes) {
+    struct fblock* b;
+    int c;
+
+    if (nbytes <= MAXSMALL) {
+        if (classof[MAXSMALL / 16] == 0) {
+            for (int i = 0; i <= MAXSMALL / 16; i++) {
+                for (c = 0; classes[c].size < i * 16; c++)
+                    ;
+                classof[i] = c;
             }
-            freep = prevp;
-            return (void*)(p + 1);
         }
-        if (p == freep)
-            if ((p = morecore(nunits)) == 0)
-                return 0;
+        return smallalloc(classof[(nbytes + 15) / 16]);
     }
+    if ((b = bigalloc(nbytes)) == 0)
+        return 0;
+    return (char*)b + TAGSIZE;
 }
@@ -1,4 +1,7 @@
 struct stat;
+struct memstat;
+struct spawnact;
+struct timespec;
 
 // system calls
 int fork(void);
@@ -22,6 +25,20 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int memstat(struct memstat*);
+int pgfaults(void);
+void* mmap(void*, uint64, int, int, int, int);
+int munmap(void*, uint64);
+int spawn(const char*, char**, struct spawnact*);
+void* shmcreate(const char*, uint64);
+void* shmattach(const char*);
+int shmdetach(void*);
+int clone(void (*)(void*), void*, void*);
+int futex(int*, int, int);
+int setpriority(int, int);
+int getpriority(int);
+int clock_gettime(int, struct timespec*);
+int nanosleep(const struct timespec*);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -39,3 +56,6 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void*, const void*, uint);
 void* memcpy(void*, const void*, uint);
+int ugetpid(void);
+int uuptime(void);
+int uclock_gettime(struct timespec*);
@@ -1,11 +1,14 @@
 #include "kernel/fcntl.h"
 #include "kernel/fs.h"
 #include "kernel/memlayout.h"
+#include "kernel/memstat.h"
 #include "kernel/param.h"
 #include "kernel/riscv.h"
 #include "kernel/stat.h"
 #include "kernel/syscall.h"
+#include "kernel/time.h"
 #include "kernel/types.h"
+#include "kernel/vdso.h"
 #include "user/user.h"
 
 //
@@ -1831,9 +1834,11 @@ void dirfile(char* s) {
 // test that iput() is called at the end of _namei().
 // also tests empty file names.
 void iref(char* s) {
+    // more than the kernel's old fixed-size inode table held.
+    enum { NIREF = 51 };
     int i, fd;
 
-    for (i = 0; i < NINODE + 1; i++) {
+    for (i = 0; i < NIREF; i++) {
         if (mkdir("irefd") != 0) {
             printf("%s: mkdir irefd failed\n", s);
             exit(1);
@@ -1855,7 +1860,7 @@ void iref(char* s) {
     }
 
     // clean up
-    for (i = 0; i < NINODE + 1; i++) {
+    for (i = 0; i < NIREF; i++) {
         chdir("..");
         unlink("irefd");
     }
@@ -1901,6 +1906,892 @@ void forktest(char* s) {
     }
 }
 
+// copy-on-write fork: neither process may see the other's
+// writes, including a write done by the kernel (read() into
+// a page that is still shared).
+void cow(char* s) {
+    enum { NPG = 64 };
+    int fds[2], pid, xstatus;
+    char* p;
+
+    p = sbrk(NPG * PGSIZE);
+    if (p == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < NPG * PGSIZE; i += 512)
+        p[i] = 'p';
+    p[1] = 'p';
+
+    if (pipe(fds) < 0) {
+        printf("%s: pipe() failed\n", s);
+        exit(1);
+    }
+    if (write(fds[1], "k", 1) != 1) {
+        printf("%s: pipe write failed\n", s);
+        exit(1);
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        if (read(fds[0], p + 1, 1) != 1 || p[1] != 'k') {
+            printf("%s: read into cow page failed\n", s);
+            exit(1);
+        }
+        for (int i = 0; i < NPG * PGSIZE; i += 512) {
+            if (p[i] != 'p') {
+                printf("%s: child sees wrong data\n", s);
+                exit(1);
+            }
+            p[i] = 'c';
+        }
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0)
+        exit(xstatus);
+
+    for (int i = 0; i < NPG * PGSIZE; i += 512) {
+        if (p[i] != 'p') {
+            printf("%s: parent sees child's write\n", s);
+            exit(1);
+        }
+    }
+    if (p[1] != 'p') {
+        printf("%s: parent sees child's read\n", s);
+        exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    sbrk(-NPG * PGSIZE);
+}
+
+// sbrk() only reserves address space; pages appear,
+// zeroed, on first touch.
+void lazy(char* s) {
+    enum { BIG = 512 * 1024 * 1024 };  // more than physical memory
+    int before, after;
+    char* p;
+
+    before = pgfaults();
+    p = sbrk(BIG);
+    if (p == (char*)-1) {
+        printf("%s: sbrk of more than physical memory failed\n", s);
+        exit(1);
+    }
+    for (uint64 i = 0; i < BIG; i += BIG / 16) {
+        if (p[i] != 0) {
+            printf("%s: lazily allocated page is not zero\n", s);
+            exit(1);
+        }
+        p[i + PGSIZE - 1] = 'l';
+    }
+    after = pgfaults();
+    if (after - before < 16) {
+        printf("%s: only %d page faults for 16 new pages\n", s, after - before);
+        exit(1);
+    }
+    if (sbrk(-BIG) == (char*)-1) {
+        printf("%s: sbrk shrink failed\n", s);
+        exit(1);
+    }
+}
+
+// initialized, so it lives in the file-backed data segment;
+// big enough that its middle page is not shared with other data.
+char filedata[3 * PGSIZE] = {'f'};
+
+// exec() reads a program's pages from the file on first touch.
+// read() into such a page from a pipe must fault it in before
+// the pipe's lock is taken.
+void lazyexec(char* s) {
+    int fds[2];
+    char* p = filedata + PGSIZE;
+
+    if (filedata[0] != 'f' || filedata[1] != 0) {
+        printf("%s: initialized data not read from the file\n", s);
+        exit(1);
+    }
+    if (pipe(fds) < 0) {
+        printf("%s: pipe() failed\n", s);
+        exit(1);
+    }
+    if (write(fds[1], "xyz", 3) != 3) {
+        printf("%s: pipe write failed\n", s);
+        exit(1);
+    }
+    if (read(fds[0], p, 3) != 3 || p[0] != 'x' || p[2] != 'z' || p[3] != 0) {
+        printf("%s: pipe read into file-backed page failed\n", s);
+        exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// mmap() of a file, shared and private, and of anonymous memory.
+void mmaptest(char* s) {
+    enum { FSZ = 2 * PGSIZE + PGSIZE / 2 };
+    int fd, i, pid, xstatus;
+    struct stat st;
+    char *p, *q, c;
+
+    unlink("mmapfile");
+    fd = open("mmapfile", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        printf("%s: create mmapfile failed\n", s);
+        exit(1);
+    }
+    for (i = 0; i < FSZ; i++) {
+        c = 'a' + i % 26;
+        if (write(fd, &c, 1) != 1) {
+            printf("%s: write mmapfile failed\n", s);
+            exit(1);
+        }
+    }
+
+    // shared: stores reach the file, but do not make it longer.
+    p = mmap(0, 3 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == (char*)-1) {
+        printf("%s: mmap shared failed\n", s);
+        exit(1);
+    }
+    close(fd);
+    for (i = 0; i < 3 * PGSIZE; i++) {
+        if (p[i] != (i < FSZ ? 'a' + i % 26 : 0)) {
+            printf("%s: mmap content wrong at %d\n", s, i);
+            exit(1);
+        }
+    }
+    p[0] = 'Z';
+    p[PGSIZE + 1] = 'Y';
+    p[FSZ] = 'X';
+    if (munmap(p, 3 * PGSIZE) < 0) {
+        printf("%s: munmap failed\n", s);
+        exit(1);
+    }
+    fd = open("mmapfile", O_RDWR);
+    if (fd < 0) {
+        printf("%s: open mmapfile failed\n", s);
+        exit(1);
+    }
+
+    // private: stores stay in this process.
+    p = mmap(0, FSZ, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p == (char*)-1) {
+        printf("%s: mmap private failed\n", s);
+        exit(1);
+    }
+    if (p[0] != 'Z' || p[PGSIZE + 1] != 'Y' || p[1] != 'b') {
+        printf("%s: shared stores not written back\n", s);
+        exit(1);
+    }
+    p[1] = 'W';
+    munmap(p, FSZ);
+    p = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == (char*)-1 || p[1] != 'b') {
+        printf("%s: private store reached the file\n", s);
+        exit(1);
+    }
+    munmap(p, PGSIZE);
+    if (read(fd, &c, 1) != 1 || c != 'Z' || fstat(fd, &st) < 0 || st.size != FSZ) {
+        printf("%s: mmapfile has the wrong size\n", s);
+        exit(1);
+    }
+    close(fd);
+    unlink("mmapfile");
+
+    // anonymous: private and shared across fork.
+    p = mmap(0, 4 * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    q = mmap(0, 4 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == (char*)-1 || q == (char*)-1) {
+        printf("%s: mmap anonymous failed\n", s);
+        exit(1);
+    }
+    p[0] = 'p';
+    q[0] = 'q';
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        if (p[0] != 'p' || q[0] != 'q')
+            exit(1);
+        p[0] = 'c';
+        q[0] = 'c';
+        q[3 * PGSIZE] = 'c';
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0 || p[0] != 'p' || q[0] != 'c' || q[3 * PGSIZE] != 'c') {
+        printf("%s: anonymous mappings not inherited correctly\n", s);
+        exit(1);
+    }
+
+    // a hole punched by munmap() is no longer accessible.
+    if (munmap(q + PGSIZE, PGSIZE) < 0 || q[2 * PGSIZE] != 0) {
+        printf("%s: munmap of a middle page failed\n", s);
+        exit(1);
+    }
+    pid = fork();
+    if (pid == 0) {
+        q[PGSIZE] = 'x';
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != -1) {
+        printf("%s: store to an unmapped page succeeded\n", s);
+        exit(1);
+    }
+    munmap(p, 4 * PGSIZE);
+    munmap(q, 4 * PGSIZE);
+}
+
+// a PROT_NONE mapping must be inaccessible to the process
+// and to system calls that copy from it.
+void mmapnone(char* s) {
+    int fds[2], pid, xstatus;
+    char* p;
+
+    p = mmap(0, PGSIZE, 0, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == (char*)-1) {
+        printf("%s: mmap PROT_NONE failed\n", s);
+        exit(1);
+    }
+    if (pipe(fds) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    if (write(fds[1], p, 10) != -1) {
+        printf("%s: write from a PROT_NONE page succeeded\n", s);
+        exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+    if ((pid = fork()) < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        printf("%s: read %d from a PROT_NONE page\n", s, *(volatile char*)p);
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != -1) {
+        printf("%s: PROT_NONE page was readable\n", s);
+        exit(1);
+    }
+    munmap(p, PGSIZE);
+}
+
+// a big heap gets 2 MB pages, which are split again when the
+// heap shrinks to the middle of one, and which fork() shares
+// whole, copy-on-write.
+void thp(char* s) {
+    enum { SZ = 8 * 1024 * 1024 };
+    int before, faults, pid, xstatus;
+    char* p;
+
+    sbrk(MEGAROUNDUP((uint64)sbrk(0)) - (uint64)sbrk(0));
+    p = sbrk(SZ);
+    if (p == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    before = pgfaults();
+    for (int i = 0; i < SZ; i += PGSIZE)
+        p[i] = i / PGSIZE;
+    faults = pgfaults() - before;
+    if (faults >= SZ / PGSIZE) {
+        printf("%s: %d page faults for %d pages, no megapages\n", s, faults, SZ / PGSIZE);
+        exit(1);
+    }
+
+    if (sbrk(-(SZ / 4 + SZ / 8)) == (char*)-1) {
+        printf("%s: sbrk shrink failed\n", s);
+        exit(1);
+    }
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        for (int i = 0; i < SZ - SZ / 4 - SZ / 8; i += PGSIZE) {
+            if (p[i] != (char)(i / PGSIZE))
+                exit(1);
+            p[i] = 0;
+        }
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: child saw wrong data\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < SZ - SZ / 4 - SZ / 8; i += PGSIZE) {
+        if (p[i] != (char)(i / PGSIZE)) {
+            printf("%s: parent sees child's write\n", s);
+            exit(1);
+        }
+    }
+
+    // the parent's first 2 MB is still one megapage: writing
+    // all of it takes one fault, not one per 4 KB page.
+    before = pgfaults();
+    for (int i = 0; i < MEGAPGSIZE; i += PGSIZE)
+        p[i] = 0;
+    faults = pgfaults() - before;
+    if (faults > 1) {
+        printf("%s: %d page faults writing a megapage after fork\n", s, faults);
+        exit(1);
+    }
+}
+
+// spawn() runs a program in a new process without fork(),
+// with the child's files set up by file actions.
+void spawntest(char* s) {
+    char* args[] = {"echo", "spawned", 0};
+    struct spawnact acts[3];
+    char buf[16];
+    int fd, pid, xstatus, n;
+
+    unlink("spawnout");
+    fd = open("spawnout", O_CREATE | O_WRONLY);
+    if (fd < 0) {
+        printf("%s: create spawnout failed\n", s);
+        exit(1);
+    }
+    acts[0] = (struct spawnact){SPAWN_DUP2, fd, 1};
+    acts[1] = (struct spawnact){SPAWN_CLOSE, fd, 0};
+    acts[2].op = 0;
+    pid = spawn("echo", args, acts);
+    close(fd);
+    if (pid < 0) {
+        printf("%s: spawn failed\n", s);
+        exit(1);
+    }
+    if (wait(&xstatus) != pid || xstatus != 0) {
+        printf("%s: spawned echo failed\n", s);
+        exit(1);
+    }
+    fd = open("spawnout", O_RDONLY);
+    n = read(fd, buf, sizeof(buf));
+    close(fd);
+    unlink("spawnout");
+    if (n != 8 || memcmp(buf, "spawned\n", 8) != 0) {
+        printf("%s: wrong output from spawned echo\n", s);
+        exit(1);
+    }
+
+    if (spawn("nosuchprogram", args, 0) != -1) {
+        printf("%s: spawn of a missing program succeeded\n", s);
+        exit(1);
+    }
+    acts[0] = (struct spawnact){SPAWN_DUP2, NOFILE, 1};
+    acts[1].op = 0;
+    if (spawn("echo", args, acts) != -1) {
+        printf("%s: spawn with a bad file action succeeded\n", s);
+        exit(1);
+    }
+}
+
+// a named shared memory object: a process that attaches it
+// by name, and a child that inherits it, see the same pages.
+void shmtest(char* s) {
+    enum { SIZE = 3 * PGSIZE };
+    char *p, *q;
+    int pid, xstatus;
+
+    p = shmcreate("shmtest", SIZE);
+    if (p == (char*)-1) {
+        printf("%s: shmcreate failed\n", s);
+        exit(1);
+    }
+    if (shmcreate("shmtest", SIZE) != (char*)-1) {
+        printf("%s: shmcreate of a taken name succeeded\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < SIZE; i++) {
+        if (p[i] != 0) {
+            printf("%s: new object not zeroed\n", s);
+            exit(1);
+        }
+    }
+    p[0] = 'a';
+    p[SIZE - 1] = 'b';
+
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        q = shmattach("shmtest");
+        if (q == (char*)-1 || q == p) {
+            printf("%s: shmattach failed\n", s);
+            exit(1);
+        }
+        if (q[0] != 'a' || q[SIZE - 1] != 'b')
+            exit(1);
+        q[PGSIZE] = 'c';  // seen through the other mapping
+        if (p[PGSIZE] != 'c')
+            exit(1);
+        p[1] = 'd';  // the inherited mapping is shared, too
+        shmdetach(q);
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: child did not see the object\n", s);
+        exit(1);
+    }
+    if (p[PGSIZE] != 'c' || p[1] != 'd') {
+        printf("%s: child's writes not seen\n", s);
+        exit(1);
+    }
+
+    if (shmdetach(p + PGSIZE) != 0) {
+        printf("%s: shmdetach failed\n", s);
+        exit(1);
+    }
+    if (shmattach("shmtest") != (char*)-1) {
+        printf("%s: object outlived its last mapping\n", s);
+        exit(1);
+    }
+    if (shmdetach(sbrk(0) - 1) != -1) {
+        printf("%s: shmdetach of the heap succeeded\n", s);
+        exit(1);
+    }
+}
+
+// state shared by clonetest's threads.
+static int clonelock;   // 0 free, 1 taken, 2 taken with waiters
+static int clonecount;  // incremented under clonelock
+static char* clonebrk[4];
+
+static void clonemutexlock(void) {
+    int c;
+
+    if ((c = __sync_val_compare_and_swap(&clonelock, 0, 1)) == 0)
+        return;
+    if (c != 2)
+        c = __sync_lock_test_and_set(&clonelock, 2);
+    while (c != 0) {
+        futex(&clonelock, FUTEX_WAIT, 2);
+        c = __sync_lock_test_and_set(&clonelock, 2);
+    }
+}
+
+static void clonemutexunlock(void) {
+    if (__sync_fetch_and_sub(&clonelock, 1) != 1) {
+        clonelock = 0;
+        __sync_synchronize();
+        futex(&clonelock, FUTEX_WAKE, 1);
+    }
+}
+
+static void clonethread(void* arg) {
+    int i = (int)(uint64)arg;
+
+    for (int j = 0; j < 1000; j++) {
+        clonemutexlock();
+        clonecount++;
+        clonemutexunlock();
+    }
+    // grow the shared heap concurrently; the threads must get
+    // disjoint pieces.
+    clonebrk[i] = sbrk(PGSIZE);
+    if (clonebrk[i] != (char*)-1)
+        clonebrk[i][0] = 'a' + i;
+    exit(0);
+}
+
+// threads made by clone() share memory and the heap break,
+// and a futex-based mutex keeps their increments exact.
+void clonetest(char* s) {
+    enum { N = 4, STACK = 2 * PGSIZE };
+    char* stacks;
+    int i, xstatus;
+
+    stacks = sbrk(N * STACK);
+    if (stacks == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    clonecount = 0;
+    clonemutexlock();  // hold the threads back until all exist
+    for (i = 0; i < N; i++) {
+        if (clone(clonethread, (void*)(uint64)i, stacks + (i + 1) * STACK) < 0) {
+            printf("%s: clone failed\n", s);
+            exit(1);
+        }
+    }
+    clonemutexunlock();
+    for (i = 0; i < N; i++) {
+        if (wait(&xstatus) < 0 || xstatus != 0) {
+            printf("%s: thread failed\n", s);
+            exit(1);
+        }
+    }
+    if (clonecount != N * 1000) {
+        printf("%s: count %d, want %d\n", s, clonecount, N * 1000);
+        exit(1);
+    }
+    for (i = 0; i < N; i++) {
+        if (clonebrk[i] == (char*)-1 || clonebrk[i][0] != 'a' + i) {
+            printf("%s: thread's sbrk lost\n", s);
+            exit(1);
+        }
+        for (int j = 0; j < i; j++) {
+            if (clonebrk[j] == clonebrk[i]) {
+                printf("%s: threads got the same heap\n", s);
+                exit(1);
+            }
+        }
+    }
+    if (futex(&clonelock, FUTEX_WAIT, 1) != -1) {
+        printf("%s: futex wait on a changed value slept\n", s);
+        exit(1);
+    }
+    if (clone(clonethread, 0, stacks + 1) != -1) {
+        printf("%s: clone with an unaligned stack succeeded\n", s);
+        exit(1);
+    }
+}
+
+// malloc() keeps objects of different sizes apart, and gives
+// a big free block at the top of the heap back to the kernel.
+void malloctrim(char* s) {
+    enum { N = 200, BIG = 1024 * 1024 };
+    char *p[N], *big, *brk;
+    int i, j;
+
+    for (i = 0; i < N; i++) {
+        if ((p[i] = malloc(i * 7 % 1000 + 1)) == 0) {
+            printf("%s: malloc failed\n", s);
+            exit(1);
+        }
+        memset(p[i], i, i * 7 % 1000 + 1);
+    }
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < i * 7 % 1000 + 1; j++) {
+            if (p[i][j] != (char)i) {
+                printf("%s: objects overlap\n", s);
+                exit(1);
+            }
+        }
+        free(p[i]);
+    }
+
+    brk = sbrk(0);
+    if ((big = malloc(BIG)) == 0) {
+        printf("%s: malloc of a big block failed\n", s);
+        exit(1);
+    }
+    memset(big, 1, BIG);
+    if (sbrk(0) < brk + BIG) {
+        printf("%s: heap did not grow\n", s);
+        exit(1);
+    }
+    free(big);
+    if (sbrk(0) >= brk + BIG) {
+        printf("%s: heap not trimmed\n", s);
+        exit(1);
+    }
+}
+
+// setpriority() and getpriority(); children inherit the
+// priority.
+void prioritytest(char* s) {
+    int pid = getpid(), xstatus, old;
+
+    old = getpriority(pid);
+    if (old < 0 || old >= NPRIO) {
+        printf("%s: getpriority returned %d\n", s, old);
+        exit(1);
+    }
+    if (setpriority(pid, NPRIO) != -1 || setpriority(pid, -1) != -1) {
+        printf("%s: setpriority accepted a bad priority\n", s);
+        exit(1);
+    }
+    if (getpriority(-1) != -1) {
+        printf("%s: getpriority of a bad pid succeeded\n", s);
+        exit(1);
+    }
+    if (setpriority(pid, NPRIO - 1) != 0 || getpriority(pid) != NPRIO - 1) {
+        printf("%s: setpriority failed\n", s);
+        exit(1);
+    }
+    if ((pid = fork()) < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0)
+        exit(getpriority(getpid()) == NPRIO - 1 ? 0 : 1);
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: child did not inherit the priority\n", s);
+        exit(1);
+    }
+    setpriority(getpid(), old);
+}
+
+// sleepers must wake in the order of their deadlines, no
+// earlier than asked, and a killed sleeper must leave the
+// timer heap without waiting for its tick.
+void sleeporder(char* s) {
+    enum { N = 4 };
+    int fds[2], pid, xstatus, t0;
+    char order[N];
+
+    if (pipe(fds) < 0) {
+        printf("%s: pipe failed\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < N; i++) {
+        if ((pid = fork()) < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pid == 0) {
+            char c = i;
+            t0 = uptime();
+            sleep(3 * (N - i));
+            if (uptime() - t0 < 3 * (N - i))
+                exit(1);
+            write(fds[1], &c, 1);
+            exit(0);
+        }
+    }
+    close(fds[1]);
+    if (read(fds[0], order, N) != N) {
+        printf("%s: read failed\n", s);
+        exit(1);
+    }
+    close(fds[0]);
+    for (int i = 0; i < N; i++) {
+        wait(&xstatus);
+        if (xstatus != 0) {
+            printf("%s: sleep returned early\n", s);
+            exit(1);
+        }
+        if (order[i] != N - 1 - i) {
+            printf("%s: sleepers woke out of order\n", s);
+            exit(1);
+        }
+    }
+
+    if ((pid = fork()) < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        sleep(1000000);
+        exit(0);
+    }
+    sleep(1);
+    t0 = uptime();
+    kill(pid);
+    wait(&xstatus);
+    if (xstatus != -1 || uptime() - t0 > 100) {
+        printf("%s: killed sleeper did not exit\n", s);
+        exit(1);
+    }
+}
+
+// clock_gettime() must not go backwards and must agree with
+// uptime(); nanosleep() must sleep at least as long as asked,
+// and refuse a bad span.
+void clocktest(char* s) {
+    struct timespec a, b, d;
+    uint64 t0, t1;
+
+    if (clock_gettime(CLOCK_MONOTONIC + 1, &a) != -1) {
+        printf("%s: clock_gettime accepted a bad clock\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < 100; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &a);
+        clock_gettime(CLOCK_MONOTONIC, &b);
+        t0 = a.tv_sec * NSEC_PER_SEC + a.tv_nsec;
+        t1 = b.tv_sec * NSEC_PER_SEC + b.tv_nsec;
+        if (a.tv_nsec >= NSEC_PER_SEC || t1 < t0) {
+            printf("%s: clock went backwards\n", s);
+            exit(1);
+        }
+    }
+    t0 = uptime();
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    if (a.tv_sec * 10 + a.tv_nsec / (NSEC_PER_SEC / 10) < t0) {
+        printf("%s: clock disagrees with uptime\n", s);
+        exit(1);
+    }
+
+    d.tv_sec = 0;
+    d.tv_nsec = NSEC_PER_SEC;
+    if (nanosleep(&d) != -1) {
+        printf("%s: nanosleep accepted a bad span\n", s);
+        exit(1);
+    }
+    for (int ns = 10000; ns <= 10000000; ns *= 10) {
+        d.tv_nsec = ns;
+        clock_gettime(CLOCK_MONOTONIC, &a);
+        if (nanosleep(&d) != 0) {
+            printf("%s: nanosleep failed\n", s);
+            exit(1);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &b);
+        t0 = a.tv_sec * NSEC_PER_SEC + a.tv_nsec;
+        t1 = b.tv_sec * NSEC_PER_SEC + b.tv_nsec;
+        if (t1 - t0 < ns) {
+            printf("%s: nanosleep(%d) returned early\n", s, ns);
+            exit(1);
+        }
+    }
+}
+
+void vdsothread(void* arg) {
+    exit(ugetpid() == getpid() ? 0 : 1);
+}
+
+// the vdso page must give the same pid and time as the
+// system calls, in a forked child and a clone()d thread too,
+// and user code must not be able to write it.
+void vdsotest(char* s) {
+    struct timespec a, b;
+    char* stack;
+    int pid, xstatus, t;
+
+    if (ugetpid() != getpid()) {
+        printf("%s: ugetpid %d, getpid %d\n", s, ugetpid(), getpid());
+        exit(1);
+    }
+    t = uptime();
+    if (uuptime() < t || uuptime() > t + 5) {
+        printf("%s: uuptime disagrees with uptime\n", s);
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &a);
+    uclock_gettime(&b);
+    if (b.tv_sec < a.tv_sec || (b.tv_sec == a.tv_sec && b.tv_nsec < a.tv_nsec)) {
+        printf("%s: uclock_gettime is behind clock_gettime\n", s);
+        exit(1);
+    }
+
+    if ((pid = fork()) < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0)
+        exit(ugetpid() == getpid() ? 0 : 1);
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: wrong ugetpid in child\n", s);
+        exit(1);
+    }
+
+    if ((stack = sbrk(PGSIZE)) == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    if (clone(vdsothread, 0, stack + PGSIZE) < 0) {
+        printf("%s: clone failed\n", s);
+        exit(1);
+    }
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: wrong ugetpid in thread\n", s);
+        exit(1);
+    }
+
+    if ((pid = fork()) < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        ((struct vdso*)VDSO)->pid[0] = 1;
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != -1) {
+        printf("%s: wrote the vdso page\n", s);
+        exit(1);
+    }
+}
+
+// wait() must return each child once, with its status, and
+// then fail; kill() must fail for pids that are gone or were
+// never handed out.
+void childlist(char* s) {
+    enum { N = 20 };
+    int pids[N], xstatus, pid, i;
+
+    for (i = 0; i < N; i++) {
+        if ((pids[i] = fork()) < 0) {
+            printf("%s: fork failed\n", s);
+            exit(1);
+        }
+        if (pids[i] == 0)
+            exit(i);
+    }
+    for (int n = 0; n < N; n++) {
+        pid = wait(&xstatus);
+        for (i = 0; i < N && pids[i] != pid; i++)
+            ;
+        if (i == N || xstatus != i) {
+            printf("%s: wait returned pid %d status %d\n", s, pid, xstatus);
+            exit(1);
+        }
+        pids[i] = 0;
+    }
+    if (wait(0) != -1) {
+        printf("%s: wait found a child too many\n", s);
+        exit(1);
+    }
+    if (kill(pid) != -1 || kill(0) != -1 || kill(-1) != -1) {
+        printf("%s: killed a pid that does not exist\n", s);
+        exit(1);
+    }
+}
+
+// pages freed while dirty and handed out again after the
+// idle loop has zeroed them must read back as all zeros.
+void zeropool(char* s) {
+    enum { N = 64 };
+    struct memstat st;
+    uint64* p;
+
+    p = (uint64*)sbrk(N * PGSIZE);
+    if (p == (uint64*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < N * PGSIZE / 8; i++)
+        p[i] = ~0UL;
+    sbrk(-N * PGSIZE);
+
+    // let the idle loop refill the pool.
+    sleep(2);
+    if (memstat(&st) < 0 || st.zeropages == 0) {
+        printf("%s: no pre-zeroed pages after sleeping\n", s);
+        exit(1);
+    }
+
+    p = (uint64*)sbrk(N * PGSIZE);
+    for (int i = 0; i < N * PGSIZE / 8; i++) {
+        if (p[i] != 0) {
+            printf("%s: word %d of a new page is %p\n", s, i, (void*)p[i]);
+            exit(1);
+        }
+    }
+    sbrk(-N * PGSIZE);
+}
+
 void sbrkbasic(char* s) {
     enum { TOOMUCH = 1024 * 1024 * 1024 };
     int i, pid, xstatus;
@@ -2491,6 +3382,22 @@ struct test {
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {cow, "cow"},
+    {lazy, "lazy"},
+    {lazyexec, "lazyexec"},
+    {mmaptest, "mmap"},
+    {mmapnone, "mmapnone"},
+    {thp, "thp"},
+    {zeropool, "zeropool"},
+    {spawntest, "spawn"},
+    {shmtest, "shm"},
+    {clonetest, "clone"},
+    {malloctrim, "malloctrim"},
+    {prioritytest, "priority"},
+    {sleeporder, "sleeporder"},
+    {clocktest, "clock"},
+    {vdsotest, "vdso"},
+    {childlist, "childlist"},
     {sbrkbasic, "sbrkbasic"},
     {sbrkmuch, "sbrkmuch"},
     {kernmem, "kernmem"},
@@ -2785,6 +3692,62 @@ void outofinodes(char* s) {
     }
 }
 
+// use more memory than the machine has, so that pages must
+// be swapped out and read back, also by a forked child that
+// shares the swapped-out pages.
+void swap(char* s) {
+    enum { SZ = 160 * 1024 * 1024 };  // more than physical memory
+    struct memstat before, after;
+    int pid, xstatus;
+    char* p;
+
+    memstat(&before);
+    p = sbrk(SZ);
+    if (p == (char*)-1) {
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+    }
+    for (int i = 0; i < SZ; i += PGSIZE)
+        *(int*)(p + i) = i;
+
+    // the pages touched first are on the disk now; give back
+    // the rest, so that fork() has memory for page tables.
+    if (sbrk(-SZ / 2) == (char*)-1) {
+        printf("%s: sbrk shrink failed\n", s);
+        exit(1);
+    }
+    pid = fork();
+    if (pid < 0) {
+        printf("%s: fork failed\n", s);
+        exit(1);
+    }
+    if (pid == 0) {
+        for (int i = 0; i < SZ / 2; i += 64 * PGSIZE) {
+            if (*(int*)(p + i) != i)
+                exit(1);
+        }
+        exit(0);
+    }
+    wait(&xstatus);
+    if (xstatus != 0) {
+        printf("%s: child read wrong data\n", s);
+        exit(1);
+    }
+
+    for (int i = 0; i < SZ / 2; i += PGSIZE) {
+        if (*(int*)(p + i) != i) {
+            printf("%s: page at %d holds %d\n", s, i, *(int*)(p + i));
+            exit(1);
+        }
+    }
+    memstat(&after);
+    if (after.swapouts == before.swapouts || after.swapins == before.swapins) {
+        printf("%s: nothing was swapped\n", s);
+        exit(1);
+    }
+    sbrk(-SZ / 2);
+}
+
 struct test slowtests[] = {
     {bigdir, "bigdir"},
     {manywrites, "manywrites"},
@@ -2792,6 +3755,7 @@ struct test slowtests[] = {
     {execout, "execout"},
     {diskfull, "diskfull"},
     {outofinodes, "outofinodes"},
+    {swap, "swap"},
 
     {0, 0},
 };
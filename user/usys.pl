@@ -36,3 +36,17 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("memstat");
+entry("pgfaults");
+entry("mmap");
+entry("munmap");
+entry("spawn");
+entry("shmcreate");
+entry("shmattach");
+entry("shmdetach");
+entry("clone");
+entry("futex");
+entry("setpriority");
+entry("getpriority");
+entry("clock_gettime");
+entry("nanosleep");
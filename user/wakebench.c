@@ -0,0 +1,132 @@
+//
+// sleep()/wakeup() cost with many processes around.  starts
+// idle processes that sleep in read() on a pipe, so that the
+// process table fills up, then times pairs bouncing a byte
+// over pipes and processes handing an inode's sleep-lock to
+// each other by reading the same file.  raise NPROC in
+// kernel/param.h to see wakeup() not depend on it.
+//
+// usage: wakebench [nidle [rounds]]
+//
+
+#include "kernel/fcntl.h"
+#include "kernel/stat.h"
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NWORKERS 4
+
+void fail(char* what) {
+    printf("wakebench: %s failed\n", what);
+    exit(1);
+}
+
+// bounce a byte between two processes rounds times.
+void pingpong(int rounds) {
+    int a[2], b[2], pid;
+    char c = 0;
+
+    if (pipe(a) < 0 || pipe(b) < 0)
+        fail("pipe");
+    if ((pid = fork()) < 0)
+        fail("fork");
+    if (pid == 0) {
+        for (int i = 0; i < rounds; i++) {
+            if (read(a[0], &c, 1) != 1 || write(b[1], &c, 1) != 1)
+                fail("child pipe");
+        }
+        exit(0);
+    }
+    for (int i = 0; i < rounds; i++) {
+        if (write(a[1], &c, 1) != 1 || read(b[0], &c, 1) != 1)
+            fail("parent pipe");
+    }
+    wait(0);
+    exit(0);
+}
+
+// open and read the shared file rounds times; every lookup
+// and read takes the inode's sleep-lock, which the other
+// workers want too.
+void lockhandoff(int rounds) {
+    char buf[64];
+    int fd;
+
+    for (int i = 0; i < rounds; i++) {
+        if ((fd = open("wakebench.tmp", O_RDONLY)) < 0)
+            fail("open");
+        if (read(fd, buf, sizeof(buf)) != sizeof(buf))
+            fail("read");
+        close(fd);
+    }
+    exit(0);
+}
+
+// run n copies of f in parallel; returns elapsed ticks.
+int run(void (*f)(int), int n, int rounds) {
+    int start, xstatus, failed = 0;
+
+    start = uptime();
+    for (int i = 0; i < n; i++) {
+        int pid = fork();
+        if (pid < 0)
+            fail("fork");
+        if (pid == 0)
+            f(rounds);
+    }
+    for (int i = 0; i < n; i++) {
+        wait(&xstatus);
+        if (xstatus != 0)
+            failed = 1;
+    }
+    if (failed)
+        fail("a worker");
+    return uptime() - start;
+}
+
+void report(char* what, int ops, int t) {
+    printf("wakebench: %s: %d in %d ticks", what, ops, t);
+    if (t > 0)
+        printf(", %d/tick", ops / t);
+    printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+    int nidle = 40, rounds = 2000, idle[2], fd, n;
+    char buf[64];
+
+    if (argc > 1)
+        nidle = atoi(argv[1]);
+    if (argc > 2)
+        rounds = atoi(argv[2]);
+
+    memset(buf, 'x', sizeof(buf));
+    if ((fd = open("wakebench.tmp", O_CREATE | O_RDWR)) < 0 || write(fd, buf, sizeof(buf)) != sizeof(buf))
+        fail("create");
+    close(fd);
+
+    // the idle processes sleep until the pipe is closed.
+    if (pipe(idle) < 0)
+        fail("pipe");
+    for (n = 0; n < nidle; n++) {
+        int pid = fork();
+        if (pid < 0)
+            break;
+        if (pid == 0) {
+            close(idle[1]);
+            read(idle[0], buf, 1);
+            exit(0);
+        }
+    }
+    close(idle[0]);
+    printf("wakebench: %d idle processes\n", n);
+
+    report("pipe round trips", NWORKERS * rounds, run(pingpong, NWORKERS, rounds));
+    report("opens and reads", NWORKERS * rounds, run(lockhandoff, NWORKERS, rounds));
+
+    close(idle[1]);
+    while (n-- > 0)
+        wait(0);
+    unlink("wakebench.tmp");
+    exit(0);
+}